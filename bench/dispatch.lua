@@ -0,0 +1,45 @@
+-- interpreter loop benchmark: card-script style condition checks (method
+-- calls, field reads, comparisons, small loops over a group) and some
+-- plain recursion. compare builds with and without LUA_USE_JUMPTABLE.
+--
+--   lua bench/dispatch.lua [rounds]
+
+local rounds = tonumber(arg[1]) or 200000
+
+local Card = {}
+Card.__index = Card
+function Card:GetCode() return self.code end
+function Card:GetLevel() return self.level end
+function Card:IsFaceup() return self.pos & 0x5 ~= 0 end
+function Card:IsControler(p) return self.controler == p end
+
+local group = {}
+for i = 1, 40 do
+  group[i] = setmetatable({ code = 1000 + i, level = i % 12 + 1,
+                            pos = i % 3 == 0 and 0x8 or 0x1, controler = i % 2 }, Card)
+end
+
+local function filter(c, tp, lv)
+  return c:IsFaceup() and c:IsControler(tp) and c:GetLevel() >= lv and c:GetCode() ~= 1004
+end
+
+local function count(tp, lv)
+  local n = 0
+  for i = 1, #group do
+    if filter(group[i], tp, lv) then n = n + 1 end
+  end
+  return n
+end
+
+local function fib(n) if n < 2 then return n end return fib(n - 1) + fib(n - 2) end
+
+local t0 = os.clock()
+local n = 0
+for r = 1, rounds do
+  n = n + count(r % 2, r % 8)
+end
+local t1 = os.clock()
+local f = fib(30)
+local t2 = os.clock()
+
+print(string.format("conditions %.3fs  recursion %.3fs  (%d %d)", t1 - t0, t2 - t1, n, f))
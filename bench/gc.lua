@@ -0,0 +1,56 @@
+-- collector benchmark on a duel-shaped heap: a large set of long-lived
+-- script objects (card tables, effect closures, prototypes) and steps that
+-- each allocate many short-lived groups, closures and strings.
+--
+--   lua bench/gc.lua incremental|generational [steps]
+--
+-- prints the total time and the longest and 99th percentile step, which
+-- include the collector work done during the step.
+
+local mode  = arg[1] or "incremental"
+local steps = tonumber(arg[2]) or 20000
+
+collectgarbage(mode)
+
+-- long-lived: what loading the card scripts of a duel leaves behind.
+local cards = {}
+for code = 1, 600 do
+  local s = { code = code, listed_names = { code + 1, code + 2 } }
+  for e = 1, 8 do
+    local id = code * 10 + e
+    s["filter" .. e] = function(c) return c.code ~= id and c.level >= e end
+    s["effect" .. e] = { code = id, range = e, count = { 1, id } }
+  end
+  cards[code] = s
+end
+
+local field = {}
+for i = 1, 80 do
+  field[i] = { code = i * 7 % 600 + 1, level = i % 12 + 1, atk = i * 100 }
+end
+
+local pauses = {}
+local clock = os.clock
+local start = clock()
+for step = 1, steps do
+  local t0 = clock()
+  -- short-lived: groups, filter closures and messages of one step.
+  for r = 1, 10 do
+    local s = cards[(step * 7 + r) % 600 + 1]
+    local group = {}
+    for i = 1, #field do
+      local c = field[i]
+      if s.filter1(c) then group[#group + 1] = c end
+    end
+    local msg = { step = step, desc = "select " .. #group, cards = group }
+    local check = function(c) return msg.cards[1] == c end
+    s.last = check(group[1]) and msg or nil
+  end
+  pauses[step] = clock() - t0
+end
+local total = clock() - start
+
+table.sort(pauses)
+print(string.format("%-12s total %.3fs  max step %.3fms  p99 step %.3fms  heap %.0fKB",
+  mode, total, pauses[#pauses] * 1e3, pauses[math.ceil(#pauses * 0.99)] * 1e3,
+  collectgarbage("count")))
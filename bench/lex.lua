@@ -0,0 +1,93 @@
+-- compile-time benchmark: load() of card scripts, which is lexing plus
+-- parsing. with no arguments a built-in card script is used; otherwise
+-- each file given is loaded.
+--
+--   lua bench/lex.lua [script.lua...]
+--
+-- prints the best of 7 rounds over all the text, in MB/s.
+
+local sample = [==[
+--Blue-Eyes Alternative White Dragon
+local s,id=GetID()
+function s.initial_effect(c)
+	c:EnableReviveLimit()
+	--special summon from hand by revealing
+	local e1=Effect.CreateEffect(c)
+	e1:SetDescription(aux.Stringid(id,0))
+	e1:SetType(EFFECT_TYPE_FIELD)
+	e1:SetCode(EFFECT_SPSUMMON_PROC)
+	e1:SetProperty(EFFECT_FLAG_UNCOPYABLE)
+	e1:SetRange(LOCATION_HAND)
+	e1:SetCountLimit(1,id,EFFECT_COUNT_CODE_OATH)
+	e1:SetCondition(s.spcon)
+	e1:SetTarget(s.sptg)
+	e1:SetOperation(s.spop)
+	c:RegisterEffect(e1)
+	--[[
+		destroy: target 1 monster your opponent controls; destroy it.
+		This card cannot attack the turn you activate this effect.
+	]]
+	local e2=Effect.CreateEffect(c)
+	e2:SetDescription(aux.Stringid(id,1))
+	e2:SetCategory(CATEGORY_DESTROY)
+	e2:SetType(EFFECT_TYPE_IGNITION)
+	e2:SetProperty(EFFECT_FLAG_CARD_TARGET)
+	e2:SetRange(LOCATION_MZONE)
+	e2:SetCountLimit(1)
+	e2:SetCost(s.descost)
+	e2:SetTarget(s.destg)
+	e2:SetOperation(s.desop)
+	c:RegisterEffect(e2)
+end
+s.listed_names={CARD_BLUEEYES_W_DRAGON}
+function s.spfilter(c)
+	return c:IsCode(CARD_BLUEEYES_W_DRAGON) and not c:IsPublic()
+end
+function s.spcon(e,c)
+	if c==nil then return true end
+	local tp=c:GetControler()
+	return Duel.GetLocationCount(tp,LOCATION_MZONE)>0
+		and Duel.IsExistingMatchingCard(s.spfilter,tp,LOCATION_HAND,0,1,c)
+end
+function s.destg(e,tp,eg,ep,ev,re,r,rp,chk,chkc)
+	if chkc then return chkc:IsLocation(LOCATION_MZONE) and chkc:IsControler(1-tp) end
+	if chk==0 then return Duel.IsExistingTarget(aux.TRUE,tp,0,LOCATION_MZONE,1,nil) end
+	Duel.Hint(HINT_SELECTMSG,tp,HINTMSG_DESTROY)
+	local g=Duel.SelectTarget(tp,aux.TRUE,tp,0,LOCATION_MZONE,1,1,nil)
+	Duel.SetOperationInfo(0,CATEGORY_DESTROY,g,1,0,0)
+end
+function s.desop(e,tp,eg,ep,ev,re,r,rp)
+	local tc=Duel.GetFirstTarget()
+	if tc and tc:IsRelateToEffect(e) then
+		Duel.Destroy(tc,REASON_EFFECT)
+	end
+end
+]==]
+
+local scripts = {}
+if #arg == 0 then
+  for i = 1, 2000 do scripts[i] = sample end
+else
+  for i = 1, #arg do
+    local f = assert(io.open(arg[i], "rb"))
+    scripts[i] = f:read("a")
+    f:close()
+  end
+end
+
+local bytes = 0
+for i = 1, #scripts do bytes = bytes + #scripts[i] end
+
+local best = math.huge
+for round = 1, 7 do
+  local t0 = os.clock()
+  for i = 1, #scripts do
+    local f, err = load(scripts[i], "=s")
+    if not f and #arg > 0 then error(arg[i] .. ": " .. err) end
+  end
+  best = math.min(best, os.clock() - t0)
+  collectgarbage()
+end
+
+print(string.format("%d scripts, %.1fKB  %.1f MB/s", #scripts, bytes / 1024,
+  bytes / best / 1e6))
@@ -0,0 +1,25 @@
+-- protected call benchmark: condition-style functions run under pcall,
+-- most succeeding, some raising an error. compare the default build with
+-- one using C++ exceptions (test/lua/build.sh out -ULUA_USE_LONGJMP).
+--
+--   lua bench/pcall.lua
+
+local c = { code = 1234, level = 4, atk = 1800 }
+local function cond(e, tp) return e.level >= 4 and e.atk > 1500 and tp == 0 end
+local function failing(e) if e.atk > 1000 then error("no") end end
+local pcall = pcall
+
+local n = 0
+local t0 = os.clock()
+for i = 1, 10000000 do
+  local ok, r = pcall(cond, c, 0)
+  if r then n = n + 1 end
+end
+local t1 = os.clock()
+for i = 1, 1000000 do
+  if not pcall(failing, c) then n = n + 1 end
+end
+local t2 = os.clock()
+
+print(string.format("ok %.1f ns/pcall  error %.1f ns/pcall  (%d)",
+  (t1 - t0) * 100, (t2 - t1) * 1000, n))
@@ -1,4 +1,10 @@
 {
+  "variables": {
+    "lua_jumptable%": "false",
+    "lua_jit%": "false",
+    "lua_swisstable%": "false",
+    "lua_exceptions%": "false"
+  },
   "targets": [
     {
       "target_name": "ocgcore",
@@ -6,10 +12,25 @@
         "<!(node -e \"require('nan')\")",
         "ygocore/lua"
       ],
-      "defines": [ "LUA_USE_LONGJMP=1" ],
       "conditions": [
+        ["lua_exceptions=='true'", {
+          "cflags_cc!": [ "-fno-exceptions" ],
+          "xcode_settings": { "GCC_ENABLE_CPP_EXCEPTIONS": "YES" },
+          "msvs_settings": { "VCCLCompilerTool": { "ExceptionHandling": 1 } }
+        }, {
+          "defines": [ "LUA_USE_LONGJMP=1" ]
+        } ],
         ["OS=='linux'", { "defines": [ "LUA_USE_POSIX=1" ] } ],
-        ["OS=='mac'", { "defines": [ "LUA_USE_POSIX=1" ] } ]
+        ["OS=='mac'", { "defines": [ "LUA_USE_POSIX=1" ] } ],
+        ["lua_jumptable=='true'", {
+          "defines": [ "LUA_USE_JUMPTABLE=1" ]
+        } ],
+        ["lua_jit=='true' and target_arch=='x64' and OS!='win'", {
+          "defines": [ "LUA_USE_JIT=1" ]
+        } ],
+        ["lua_swisstable=='true'", {
+          "defines": [ "LUA_USE_SWISSTABLE=1" ]
+        } ]
       ],
       "sources": [
         "ygocore/main.cc",
@@ -21,6 +42,7 @@
         "ygocore/lua/lzio.cc",
         "ygocore/lua/lctype.cc",
         "ygocore/lua/lvm.cc",
+        "ygocore/lua/ljit.cc",
         "ygocore/lua/lgc.cc",
         "ygocore/lua/ldebug.cc",
         "ygocore/lua/lmathlib.cc",
@@ -40,6 +62,7 @@
         "ygocore/lua/lmem.cc",
         "ygocore/lua/ldump.cc",
         "ygocore/lua/lauxlib.cc",
+        "ygocore/lua/lalloc.cc",
         "ygocore/lua/lstring.cc",
         "ygocore/lua/loadlib.cc",
         "ygocore/lua/lapi.cc",
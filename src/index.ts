@@ -8,4 +8,198 @@ function engineSetResponse(duel: number, response: Buffer) {
   ));
 }
 
-export const engine = { ...raw, setResponse: engineSetResponse } as OCGEngine<number>;
+export type GCMode = 'incremental' | 'generational';
+export type GCPolicy = 'auto' | 'idle';
+
+export interface MemoryUsage {
+  used: number;
+  reserved: number;
+  limit: number;
+}
+
+export interface PrecompileOptions {
+  threads?: number;
+  frozenConstants?: boolean;
+}
+
+export interface PrecompileResult {
+  compiled: number;
+  errors: { name: string, message: string }[];
+}
+
+// set in the flags of `process` when the step went over its budget.
+export const PROCESS_FLAG_ABORTED = 0x100;
+// set in the flags of `process` when a script ran out of the duel's memory.
+export const PROCESS_FLAG_MEMORY = 0x200;
+
+export interface StepBudget {
+  instructions?: number;
+  timeMs?: number;
+}
+
+export interface AbortInfo {
+  reason: 'instruction' | 'time';
+  code: number;   // card that was running, 0 for other scripts
+  chunk: string;
+  line: number;
+}
+
+export interface ProfilerOptions {
+  period?: number;     // lua instructions per sample, 1 to 2^24 (default 10000)
+  calls?: boolean;
+}
+
+export interface ProfileEntry {
+  code: number;        // card code, 0 for other scripts
+  chunk: string;       // script name when code is 0
+  function: string;
+  lineDefined: number;
+  line: number;
+  calls: number;       // counted on lineDefined
+  samples: number;
+  timeUs: number;
+}
+
+export interface Profile {
+  period: number;
+  entries: ProfileEntry[];
+}
+
+export function parseProfile(report: Buffer): Profile {
+  const entries: ProfileEntry[] = [];
+  if (report.length < 8) {
+    return { period: 0, entries };
+  }
+
+  const period = report.readUInt32LE(0);
+  const count = report.readUInt32LE(4);
+  let offset = 8;
+
+  const readString = () => {
+    const length = report.readUInt16LE(offset);
+    const value = report.toString('utf8', offset + 2, offset + 2 + length);
+    offset += 2 + length;
+    return value;
+  };
+
+  for (let i = 0; i < count; ++i) {
+    const code = report.readUInt32LE(offset);
+    const lineDefined = report.readInt32LE(offset + 4);
+    const line = report.readInt32LE(offset + 8);
+    const calls = report.readUInt32LE(offset + 12);
+    const samples = report.readUInt32LE(offset + 16);
+    const timeUs = report.readUInt32LE(offset + 20);
+    offset += 24;
+
+    const fn = readString();
+    const chunk = readString();
+    entries.push({ code, chunk, function: fn, lineDefined, line, calls, samples, timeUs });
+  }
+
+  return { period, entries };
+}
+
+export interface SnapshotZone {
+  player: number;
+  location: number;
+  data: Buffer;        // as returned by queryFieldCard
+}
+
+export interface Snapshot {
+  fieldInfo: Buffer;   // as returned by queryFieldInfo
+  zones: SnapshotZone[];
+}
+
+// locations of a snapshot, in order, for player 0 then player 1.
+const SNAPSHOT_LOCATIONS = [0x04, 0x08, 0x10, 0x20, 0x40];
+
+export function parseSnapshot(snapshot: Buffer): Snapshot {
+  let offset = 0;
+  const readSection = () => {
+    const length = snapshot.readInt32LE(offset);
+    const data = snapshot.slice(offset + 4, offset + 4 + length);
+    offset += 4 + length;
+    return data;
+  };
+
+  const fieldInfo = readSection();
+  const zones: SnapshotZone[] = [];
+  for (let player = 0; player < 2; ++player) {
+    for (const location of SNAPSHOT_LOCATIONS) {
+      zones.push({ player, location, data: readSection() });
+    }
+  }
+
+  return { fieldInfo, zones };
+}
+
+export interface CardChange {
+  player: number;
+  location: number;
+  sequence: number;
+  data: Buffer;        // one record of a queryFieldCard result, 4 bytes if the slot was emptied
+}
+
+export interface CountChange {
+  player: number;
+  location: number;
+  count: number;
+}
+
+export interface Changes {
+  revision: number;
+  fieldInfo: Buffer | null;  // as returned by queryFieldInfo, if it changed
+  counts: CountChange[];
+  cards: CardChange[];
+}
+
+export function parseChanges(changes: Buffer): Changes {
+  const result: Changes = { revision: changes.readUInt32LE(0), fieldInfo: null, counts: [], cards: [] };
+
+  let offset = 4;
+  while (offset + 4 <= changes.length) {
+    const player = changes.readUInt8(offset);
+    const location = changes.readUInt8(offset + 1);
+    const sequence = changes.readUInt8(offset + 2);
+    const kind = changes.readUInt8(offset + 3);
+    offset += 4;
+
+    if (kind === 0) {
+      const length = changes.readInt32LE(offset);
+      result.cards.push({ player, location, sequence, data: changes.slice(offset, offset + length) });
+      offset += length;
+    } else if (kind === 1) {
+      result.counts.push({ player, location, count: changes.readInt32LE(offset) });
+      offset += 4;
+    } else {
+      const length = changes.readInt32LE(offset);
+      result.fieldInfo = changes.slice(offset + 4, offset + 4 + length);
+      offset += 4 + length;
+    }
+  }
+
+  return result;
+}
+
+export interface EngineExtensions {
+  setGCMode(duel: number, mode: GCMode): void;
+  setGCPolicy(duel: number, policy: GCPolicy): void;
+  collectIdle(duel: number, budgetMs: number): boolean;
+  getGCCount(duel: number): number;
+  getMemoryUsage(duel: number): MemoryUsage;
+  setMemoryLimit(duel: number, bytes: number): void;
+  setRegionTeardown(duel: number, enabled: boolean): boolean;
+  setDeferredFree(duel: number, enabled: boolean): boolean;
+  freezeConstants(duel: number): number;
+  stripDebugInfo(duel: number): void;
+  precompileAll(options?: PrecompileOptions): PrecompileResult;
+  setStepBudget(duel: number, budget: StepBudget): void;
+  getAbortInfo(duel: number): AbortInfo | null;
+  startProfiler(duel: number, options?: ProfilerOptions): void;
+  stopProfiler(duel: number): Buffer;
+  querySnapshot(duel: number, queryFlags: number): Buffer;
+  getRevision(duel: number): number;
+  queryChangesSince(duel: number, revision: number, queryFlags: number): Buffer;
+}
+
+export const engine = { ...raw, setResponse: engineSetResponse } as OCGEngine<number> & EngineExtensions;
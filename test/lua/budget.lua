@@ -0,0 +1,77 @@
+-- the step budget of wrapper.cc (charge_budget): a count hook that, once
+-- the budget is gone, sets itself to fire at every instruction and fails
+-- the script, also under a pcall. an abort in a coroutine re-arms the
+-- main thread, which must then not run any further.
+
+local main = coroutine.running()
+local budget, aborted = 0, false
+local step
+
+local function hook()
+  if not aborted then
+    budget = budget - 100
+    if budget > 0 then return end
+    aborted = true
+  elseif debug.getinfo(2, "f").func == step then
+    debug.sethook(main)  -- back in the core: the step is over
+    return
+  end
+  local co = coroutine.running()
+  debug.sethook(co, hook, "", 1)
+  if co ~= main then debug.sethook(main, hook, "", 1) end
+  error("duel aborted", 0)
+end
+
+-- runs 'f' as a step of 'n' instructions
+function step(n, f, ...)
+  budget, aborted = n, false
+  debug.sethook(main, hook, "", 100)
+  local r = table.pack(pcall(f, ...))
+  return table.unpack(r, 1, r.n)
+end
+
+-- the threads of a duel get the hook of its main thread; those of the
+-- debug library do not (its hooks are lua functions kept per thread).
+local function create(f)
+  local co = coroutine.create(f)
+  debug.sethook(co, hook, "", 100)
+  return co
+end
+
+local function spin()
+  local x = 0
+  while true do x = x + 1 end
+end
+
+-- in the main thread, a pcall does not get around it
+local ok, err = step(10000, function()
+  while true do pcall(spin) end
+end)
+assert(not ok and err == "duel aborted" and aborted)
+
+-- in a coroutine: the main thread fails at its next instruction
+local ran_after = 0
+ok, err = step(10000, function()
+  local co = create(spin)
+  coroutine.resume(co)
+  ran_after = 1
+end)
+assert(not ok and err == "duel aborted", "main thread not aborted")
+assert(ran_after == 0, "main thread ran on after the abort")
+
+-- a coroutine that got the error of a nested one fails at its next
+-- check, then the main thread
+local outer
+ok, err = step(10000, function()
+  outer = create(function()
+    local inner = create(spin)
+    coroutine.resume(inner)
+    while true do ran_after = ran_after + 1 end
+  end)
+  coroutine.resume(outer)
+  ran_after = 1000
+end)
+assert(not ok and err == "duel aborted" and coroutine.status(outer) == "dead")
+assert(ran_after < 100, "nested coroutine ran on after the abort")
+
+print("budget ok")
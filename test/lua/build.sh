@@ -0,0 +1,21 @@
+#!/bin/sh
+# build the embedded lua as a standalone interpreter, for the scripts in
+# test/lua and bench.
+#
+#   test/lua/build.sh [output] [extra compiler flags...]
+#
+# e.g. test/lua/build.sh build/lua-jit -DLUA_USE_JIT=1
+#
+# MAIN=file.cc builds that program instead of the interpreter (lua.cc).
+set -e
+
+ROOT=$(cd "$(dirname "$0")/../.." && pwd)
+SRC=$ROOT/ygocore/lua
+OUT=${1:-$ROOT/build/lua}
+MAIN=${MAIN:-$SRC/lua.cc}
+[ $# -gt 0 ] && shift
+
+mkdir -p "$(dirname "$OUT")"
+# warnings are errors: the embedded lua builds clean in every variant.
+${CXX:-g++} -O2 -std=c++11 -Wall -Wextra -Werror -DLUA_USE_LONGJMP=1 -DLUA_USE_POSIX=1 "$@" \
+  -I"$SRC" $(ls "$SRC"/*.cc | grep -v -e '/lua\.cc$' -e '/luac\.cc$') "$MAIN" -o "$OUT" -lm -ldl
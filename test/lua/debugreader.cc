@@ -0,0 +1,172 @@
+/*
+** Test of the debug reader (see 'lua_setdebugreader'): the debug
+** information of the chunks it can give again is dropped on load, and
+** reloaded when needed by parsing the chunk again. The script below sets
+** what the reader gives, to check chunks that no longer parse or that
+** changed since they were loaded.
+**
+** Built and run by test/lua/run.sh.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static const char *chunk = NULL;  /* what the reader gives for "=t" */
+static size_t chunksize = 0;
+static int reads = 0;  /* calls to the reader */
+
+
+static const char *reader (void *ud, const char *source, size_t *size) {
+  (void)ud;  /* not used */
+  reads++;
+  if (chunk == NULL || strcmp(source, "=t") != 0)
+    return NULL;
+  *size = chunksize;
+  return chunk;
+}
+
+
+/* setchunk(text): sets what the reader gives (nil: nothing) */
+static int setchunk (lua_State *L) {
+  lua_settop(L, 1);
+  lua_setfield(L, LUA_REGISTRYINDEX, "chunk");  /* keep it alive */
+  lua_getfield(L, LUA_REGISTRYINDEX, "chunk");
+  chunk = lua_tolstring(L, 1, &chunksize);
+  return 0;
+}
+
+
+/* reads(): number of calls to the reader so far */
+static int getreads (lua_State *L) {
+  lua_pushinteger(L, reads);
+  return 1;
+}
+
+
+/*
+** probe(n): the function and current line of its caller, asked with 'n'
+** more values on the stack (up to LUA_MINSTACK), so that the stack has
+** little room left
+*/
+static int probe (lua_State *L) {
+  int n = (int)luaL_checkinteger(L, 1);
+  lua_Debug ar;
+  int i;
+  luaL_argcheck(L, 0 <= n && n < LUA_MINSTACK - 2, 1, "out of range");
+  for (i = 0; i < n; i++)
+    lua_pushnil(L);
+  if (!lua_getstack(L, 1, &ar))
+    return 0;
+  lua_getinfo(L, "fl", &ar);
+  lua_pushinteger(L, ar.currentline);
+  return 2;
+}
+
+
+static const char *const script = R"(
+local src = [[
+local function f(x)
+  local y = x.field
+  return y
+end
+local function g()
+  error("g failed")
+end
+local function h()
+  return debug.getinfo(1, "fl")
+end
+local function p(n)
+  local func, line = probe(n)
+  return func, line
+end
+return f, g, h, p
+]]
+
+-- dropped on load, reloaded when needed
+setchunk(src)
+local f, g, h = load(src, "=t")()
+assert(debug.getlocal(f, 1) == "x")
+local ok, err = pcall(f)
+assert(not ok and err:find("^t:2: .*local 'x'"), err)
+ok, err = pcall(g)
+assert(not ok and err == "t:6: g failed", err)
+local info = h()
+assert(info.func == h and info.currentline == 9)
+
+-- the chunk no longer parses: no debug information, and it is not
+-- asked again for the same function
+f, g, h = load(src, "=t")()
+setchunk("local function f(x) return +")
+local n = reads()
+ok, err = pcall(g)
+assert(not ok and err == "g failed", err)
+assert(reads() == n + 1)
+ok, err = pcall(g)
+assert(not ok and err == "g failed" and reads() == n + 1, err)
+ok, err = pcall(f)
+assert(not ok and not err:find("'x'"), err)
+info = h()
+assert(info.func == h and info.currentline == -1)
+
+-- the chunk changed: no debug information for what is not the same code
+setchunk(src)
+f, g, h = load(src, "=t")()
+setchunk(src:gsub("x.field", "x.field + 1"))
+assert(debug.getlocal(f, 1) == nil)
+ok, err = pcall(g)
+assert(not ok and err == "t:6: g failed", err)
+
+-- the chunk is gone
+setchunk(src)
+f, g, h = load(src, "=t")()
+setchunk(nil)
+ok, err = pcall(g)
+assert(not ok and err == "g failed", err)
+
+-- reloaded (or not) at every stack size: 'getinfo' keeps pointers into
+-- the stack while it reloads
+local p
+for _, text in ipairs({src, "return +"}) do
+  for depth = 1, 100 do
+    for extra = 0, 16 do
+      setchunk(src)
+      f, g, h, p = load(src, "=t")()
+      setchunk(text)
+      local co = coroutine.wrap(function()
+        local function rec(n)
+          if n == 0 then return p(extra) end
+          local func, line = rec(n - 1)  -- no tail call: the stack grows
+          return func, line
+        end
+        return rec(depth)
+      end)
+      local func, line = co()
+      assert(func == p and line == (text == src and 12 or -1))
+    end
+  end
+end
+
+print("debugreader ok")
+)";
+
+
+int main (void) {
+  lua_State *L = luaL_newstate();
+  int status;
+  luaL_openlibs(L);
+  lua_setdebugreader(L, reader, NULL);
+  lua_register(L, "setchunk", setchunk);
+  lua_register(L, "reads", getreads);
+  lua_register(L, "probe", probe);
+  status = luaL_dostring(L, script);
+  if (status != LUA_OK)
+    fprintf(stderr, "debugreader: %s\n", lua_tostring(L, -1));
+  lua_close(L);
+  return (status == LUA_OK) ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+-- frozen constants (duel_freeze_constants): names from the registry table
+-- _FROZEN are inlined by the parser, and assigning to one thaws it.
+
+LOCATION_HAND = 0x2; LOCATION_DECK = 0x1; TYPE_MONSTER = 0x1; HALF = 0.5
+local reg = debug.getregistry()
+reg._FROZEN = {LOCATION_HAND = 0x2, LOCATION_DECK = 0x1, TYPE_MONSTER = 0x1, HALF = 0.5}
+-- inlined and folded
+local f = load("return LOCATION_HAND + LOCATION_DECK, LOCATION_HAND | TYPE_MONSTER, HALF", "=f")
+local a, b, c = f()
+assert(a == 3 and b == 3 and c == 0.5)
+-- check no global access: remove globals, function still works
+LOCATION_HAND = nil
+assert(f() == 3)
+LOCATION_HAND = 0x2
+-- bytecode: no GETTABUP for folded expression
+local d = string.dump(f)
+assert(not d:find("LOCATION_HAND"), "name still referenced")
+-- locals shadow
+local g = load("local LOCATION_HAND = 10 return LOCATION_HAND")
+assert(g() == 10)
+-- local _ENV disables
+local h = load("local _ENV = {LOCATION_HAND = 7} return LOCATION_HAND")
+assert(h() == 7)
+-- load with env: not inlined
+local e = load("return LOCATION_HAND", "x", "t", {LOCATION_HAND = 9})
+assert(e() == 9)
+assert(reg._FROZEN.LOCATION_HAND == 2)
+-- reader-function load with env
+local parts = {"return ", "LOCATION_DECK"}
+local k = 0
+local e2 = load(function() k = k + 1 return parts[k] end, "y", "t", {LOCATION_DECK = 11})
+assert(e2() == 11)
+-- assignment thaws, chunk reparsed
+local s = load([[
+  local function get() return TYPE_MONSTER end
+  TYPE_MONSTER = 42
+  return get(), TYPE_MONSTER
+]])
+local x, y = s()
+assert(x == 42 and y == 42, tostring(x))
+assert(reg._FROZEN.TYPE_MONSTER == nil)
+-- multiple assignment targets and field
+local s2 = load("LOCATION_DECK, z = 5, 6; return LOCATION_DECK")
+assert(s2() == 5)
+-- _ENV assignment disables for the chunk
+local s3 = load("local old = _ENV; _ENV = {HALF = 2}; return HALF")
+assert(s3() == 2)
+assert(reg._FROZEN.HALF == 0.5)
+-- calls with frozen args in statements
+local s4 = load("assert(LOCATION_HAND == 2) ; select(1, LOCATION_HAND)")
+s4()
+-- a function statement assigns its name too
+reg._FROZEN.LOCATION_DECK = 1
+local s5 = load("function LOCATION_DECK() return 'fn' end; return type(LOCATION_DECK), LOCATION_DECK()")
+local ty, r = s5()
+assert(ty == "function" and r == "fn", ty)
+assert(reg._FROZEN.LOCATION_DECK == nil)
+LOCATION_DECK = 0x1
+-- but not a function stored in one of its fields
+reg._FROZEN.LOCATION_DECK = 1
+assert(not pcall(load("function LOCATION_DECK.f() end")))
+assert(not pcall(load("function LOCATION_DECK:m() end")))
+assert(reg._FROZEN.LOCATION_DECK == 1)
+-- (X) = 1 remains a syntax error
+assert(not load("(LOCATION_HAND) = 1"))
+-- syntax error still reported after restart, and nothing thawed
+assert(not load("LOCATION_HAND = 1 +"))
+assert(not load("local a = LOCATION_DECK\nLOCATION_DECK = 3\nreturn +"))
+assert(reg._FROZEN.LOCATION_HAND == 2 and reg._FROZEN.LOCATION_DECK == 1)
+-- error line numbers preserved
+local ok, err = pcall(load("\n\nlocal x = LOCATION_HAND .. nil"))
+assert(err:find(":3:"), err)
+-- many blocks reader
+local src = {}
+for i = 1, 200 do src[#src+1] = "local v"..i.." = LOCATION_HAND + "..i.."\n" end
+src[#src+1] = "LOCATION_HAND = 100\nreturn v1 + v200"
+local idx = 0
+local big = load(function() idx = idx + 1 return src[idx] end)
+assert(big() == 2 + 1 + 2 + 200, big())
+collectgarbage()
+print("frozen ok")
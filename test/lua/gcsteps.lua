@@ -0,0 +1,73 @@
+-- in generational mode, collectgarbage("step") does a small piece of a
+-- minor (or major) collection and the program runs between pieces: what
+-- it stores in old objects meanwhile must survive.
+
+collectgarbage("generational")
+collectgarbage("setmajorinc", 50)  -- majors often, in steps too
+
+local old = {}                      -- old objects receiving young values
+for i = 1, 500 do old[i] = { id = i } end
+local weakv = setmetatable({}, { __mode = "v" })
+local weakk = setmetatable({}, { __mode = "k" })
+local finalized, gcs = 0, 0
+local upv = {}
+local completed, steps = 0, 0
+
+local function check(t, i)
+  assert(t.id == i and t.s == "v" .. i and t.inner[1] == i * 2, "lost " .. i)
+end
+
+local function fresh(i)
+  return { id = i, s = "v" .. i, inner = { i * 2 } }
+end
+
+local function step()
+  steps = steps + 1
+  if collectgarbage("step") then completed = completed + 1 end
+end
+
+for round = 1, 300 do
+  for i = 1, 400 do
+    local k = (round * 400 + i) % 500 + 1
+    local t = fresh(k)
+    old[k].child = t                       -- back barrier on an old table
+    old[k].child.more = { t }
+    if i % 7 == 0 then
+      local f = function() return t end    -- closed upvalue of a closure
+      upv[k] = f
+    end
+    if i % 11 == 0 then weakv[k] = t; weakk[t] = { k } end
+    if i % 13 == 0 then
+      -- finalizer set while a sweep may be halfway
+      setmetatable({ k }, { __gc = function(o) finalized = finalized + 1 end })
+      gcs = gcs + 1
+    end
+    if i % 17 == 0 then
+      -- strings that may be dead but not swept yet
+      local s = "str" .. (i % 50)
+      old[k].str = s
+    end
+    if i % 3 == 0 then step() end
+  end
+  for k = 1, 500 do
+    local c = old[k].child
+    if c then
+      check(c, k)
+      assert(c.more[1] == c)
+      if old[k].str then assert(old[k].str:sub(1, 3) == "str") end
+    end
+    if upv[k] then check(upv[k](), k) end
+  end
+  if round % 50 == 0 then
+    -- a collection by allocation or 'collect' finishes the one in steps
+    collectgarbage("step", 64)
+    collectgarbage()
+  end
+end
+
+assert(completed > 10, "no collection completed in steps")
+for k, v in pairs(weakk) do assert(v[1] == k.id) end
+collectgarbage("incremental")
+collectgarbage()
+assert(finalized > 0 and finalized <= gcs)
+print("gcsteps ok", completed, steps)
@@ -0,0 +1,377 @@
+-- differential test of the JIT (see test/lua/jitdiff.sh): the output
+-- must be the same with and without LUA_USE_JIT. covers every opcode with
+-- all kinds of operands, metamethods, coroutines, hooks and errors.
+local out = {}
+local function P(...)
+  local t = table.pack(...)
+  for i = 1, t.n do t[i] = tostring(t[i]) end
+  out[#out + 1] = table.concat(t, " ")
+end
+local function E(f, ...)
+  local r = table.pack(pcall(f, ...))
+  for i = 1, r.n do r[i] = tostring(r[i]) end
+  P(table.concat(r, " | "))
+end
+
+local function rep(name, f, n)
+  for k = 1, (n or 3) do P(name, k); f(k) end
+end
+
+-- arithmetic with all kinds of operands
+local vals = {0, 1, -1, 7, 2.5, -0.0, 1/0, -1/0, 0/0, math.maxinteger,
+  math.mininteger, "10", "0x10", "3.5", " 4 ", "abc", true, nil, {}}
+local nv = 19
+local function arith(k)
+  for i = 1, nv do
+    for j = 1, nv do
+      local a, b = vals[i], vals[j]
+      E(function() return a + b, a - b, a * b end)
+      E(function() return a / b, a % b, a // b, a ^ b end)
+      E(function() return a & b, a | b, a ~ b, a << b, a >> b end)
+      E(function() return a == b, a ~= b end)
+      E(function() return a < b, a <= b, a > b, a >= b end)
+      E(function() return a .. b end)
+    end
+    local a = vals[i]
+    E(function() return -a, ~a, not a, #tostring(a) end)
+    E(function() return a + 1, a - 1, a * 2, 1 - a, a & 3, a | 8, a ~ 5 end)
+    E(function() return a == 1, a ~= 7, a < 3, 3 <= a, a > 1.5 end)
+    E(function() return a == "10", a ~= "abc" end)
+    E(function() return #a end)
+  end
+end
+rep("arith", arith, 2)
+
+-- metamethods
+local mt = {}
+mt.__add = function(a, b) return "add" end
+mt.__sub = function(a, b) return "sub" end
+mt.__unm = function(a) return "unm" end
+mt.__len = function(a) return 42 end
+mt.__concat = function(a, b) return "cat" end
+mt.__eq = function(a, b) return true end
+mt.__lt = function(a, b) return true end
+mt.__le = function(a, b) return false end
+mt.__band = function(a, b) return "band" end
+mt.__index = function(t, k) return k .. "!" end
+mt.__newindex = function(t, k, v) rawset(t, k, v .. "?") end
+mt.__call = function(self, x) return "called", x end
+local function metas(k)
+  local a, b = setmetatable({}, mt), setmetatable({}, mt)
+  P(a + 1, 1 - a, -a, #a, a .. "x", "x" .. a, 1 .. a .. 2, a == b, a < b, a <= b, a > b, a & 1)
+  P(a.foo, a[1], a.bar)
+  a.z = "v"; P(rawget(a, "z"))
+  P(a(5))
+  if a == b then P("eq") end
+  if a < b then P("lt") else P("nlt") end
+  if a <= b then P("le") else P("nle") end
+  local c = setmetatable({}, {__lt = function() return false end})
+  P(pcall(function() return c <= c end))
+end
+rep("metas", metas)
+
+-- loops
+local function loops(k)
+  local s = 0
+  for i = 1, 100 do s = s + i end
+  for i = 100, 1, -3 do s = s + i end
+  for i = 1, 0 do s = s + 1000 end
+  for i = 1.0, 3 do s = s + i end
+  for i = 1, 2, 0.25 do s = s + i end
+  for i = 3, 1, -0.5 do s = s + i end
+  for i = math.mininteger, math.mininteger + 2 do s = s + 1 end
+  for i = 1, math.huge do if i > 10 then break end s = s + i end
+  for i = 1, -math.huge do s = s + 1 end
+  for i = 1, 3.7 do s = s + i end
+  E(function() for i = "2", 4 do end end)
+  P("loops", s, math.type(s))
+  E(function() for i = 1, "x" do end end)
+  E(function() for i = 1, 2, {} do end end)
+  E(function() for i = nil, 2 do end end)
+  local t = {}
+  for i = 1, 10 do t[i] = i * i end
+  local acc = {}
+  for i, v in ipairs(t) do acc[#acc + 1] = i .. ":" .. v end
+  P(table.concat(acc, ","))
+  local keys = {}
+  for kk, v in pairs({a = 1, b = 2, c = 3}) do keys[#keys + 1] = kk .. v end
+  table.sort(keys); P(table.concat(keys))
+  local function iter(st, c) if c < st then return c + 1, c * 2 end end
+  for a, b in iter, 5, 0 do P("it", a, b) end
+  local n = 0
+  while n < 10 do n = n + 1; if n % 3 == 0 then goto cont end; P("w", n) ::cont:: end
+  repeat n = n - 2 until n < 0
+  P("n", n)
+end
+rep("loops", loops)
+
+-- closures and upvalues
+local function closures(k)
+  local fs = {}
+  for i = 1, 5 do
+    local j = i * 10
+    fs[i] = function() j = j + 1; return i, j end
+  end
+  for i = 1, 5 do P(fs[i]()) ; P(fs[i]()) end
+  local x = 0
+  local function inc() x = x + 1; return x end
+  inc(); inc()
+  P("x", x)
+  local ws = {}
+  local i = 1
+  while i <= 3 do
+    local v = i
+    ws[i] = function() return v end
+    i = i + 1
+  end
+  P(ws[1](), ws[2](), ws[3]())
+  do
+    local a = {}
+    for q = 1, 3 do
+      local b = q
+      a[q] = function() b = b * 2; return b end
+      if q == 2 then break end
+    end
+    P(a[1](), a[2](), a[1]())
+  end
+end
+rep("closures", closures)
+
+-- calls, varargs, tail calls
+local function va(...) return select("#", ...), ... end
+local function tail(n) if n == 0 then return "done" end return tail(n - 1) end
+local function tailc(x) return tostring(x) end
+local function deep(n) if n == 0 then return 0 end return 1 + deep(n - 1) end
+local function multi() return 1, 2, 3 end
+local function calls(k)
+  P(va()); P(va(nil)); P(va(1, nil, 3)); P(va(multi())); P(va(multi(), 10))
+  P((multi())); P(({multi()})[3], #{multi(), multi()})
+  P(tail(100000), tailc(12), deep(5000))
+  P(select(2, "a", "b", "c"), table.unpack({1, 2, 3}))
+  local t = {va(multi())}
+  P(#t, t[1], t[4])
+  P(pcall(error, "boom"))
+  local ok, e = pcall(error, {code = 1}); P(ok, type(e), e.code)
+  P(string.format("%d %s", 5, "x"), math.max(3, 9, 2))
+  local function f(a, b, ...)
+    local x, y = ...
+    return a, b, x, y, select("#", ...)
+  end
+  P(f(1)); P(f(1, 2, 3, 4, 5))
+  local obj = {n = 3}
+  function obj:get(d) return self.n + (d or 0) end
+  P(obj:get(), obj:get(4), obj.get(obj, 1))
+  P(setmetatable({}, {__call = function(_, a) return a * 2 end})(21))
+  E(function() local z; z() end)
+  E(function() local z = {}; z.x.y = 1 end)
+  E(function() return undefinedglobal.field end)
+  E(function() local s = "x"; return s:nomethod() end)
+  E(function() return ("x")() end)
+end
+rep("calls", calls)
+
+-- tables
+local function tables(k)
+  local t = {1, 2, 3, nil, 5, x = 1, ["y"] = 2, [10] = 10}
+  P(#t >= 3, t.x, t.y, t[10])
+  local big = {}
+  for i = 1, 200 do big[i] = i end
+  P(#big)
+  local s = "return {" .. string.rep("1,", 30000) .. "}"
+  local bt = load(s)()
+  P(#bt)
+  local nested = {a = {b = {c = {d = "deep"}}}}
+  P(nested.a.b.c.d)
+  local u = {}
+  u.a = 1; u.b = 2; u.a = nil
+  P(u.a, u.b)
+  for i = 1, 100 do u["k" .. i] = i end
+  P(u.k50, u.b)
+  local tmp = io.tmpfile()
+  P(io.type(tmp))
+  tmp:write("hello"); tmp:seek("set"); P(tmp:read("a")); tmp:close()
+  P(io.type(tmp))
+  local s2 = "abc"
+  P(s2:upper(), s2:len(), ("x"):rep(3))
+end
+rep("tables", tables)
+
+-- many constants (LOADKX)
+local function manyk()
+  local parts = {"local t = {}"}
+  for i = 1, 70000 do parts[#parts + 1] = ("t[%d] = 'k%d'"):format(i % 50, i) end
+  parts[#parts + 1] = "local x = 'last' .. 1.5 ; return x, t[1], t[49]"
+  return load(table.concat(parts, "\n"))
+end
+local mk = manyk()
+rep("loadkx", function() P(mk()) end)
+
+-- inline cache invalidation
+local function icinv(k)
+  local t = {a = 1}
+  local function get() return t.a end
+  P(get())
+  t.a = 2; P(get())
+  for i = 1, 50 do t["f" .. i] = i end
+  P(get())
+  t.a = nil; P(get())
+  t.a = 3; P(get())
+  t = {a = 4}; P(get())
+  local M = {}
+  M.__index = {m = function() return "m1" end}
+  local ud = setmetatable({}, M)
+  local function call() return ud.m() end
+  P(call())
+  M.__index.m = function() return "m2" end; P(call())
+  M.__index = {m = function() return "m3" end}; P(call())
+  M.__index = function() return function() return "m4" end end; P(call())
+  local f = io.tmpfile()
+  local function w(x) return f:write(x) end
+  P(io.type(w("a")))
+  getmetatable(f).__index.write = function() return "patched" end
+  P(w("b"))
+end
+rep("icinv", icinv)
+
+-- coroutines (yields from metamethods, iterators, calls)
+local function coros(k)
+  local co = coroutine.wrap(function(a)
+    local s = 0
+    for i = 1, 3 do s = s + coroutine.yield(i + a) end
+    local y = setmetatable({}, {__add = function(x, v) return coroutine.yield("add") end,
+      __lt = function() return coroutine.yield("lt") end,
+      __concat = function() return coroutine.yield("cat") end,
+      __index = function(t, key) return coroutine.yield("idx") end,
+      __eq = function() return coroutine.yield("eq") end})
+    local r = y + 1
+    local c = y < y
+    local d = "a" .. y .. "b"
+    local e = y.foo
+    local f = (y == setmetatable({}, getmetatable(y)))
+    for v in function() return coroutine.yield("iter") end do s = s + v; break end
+    return s, r, c, d, e, f
+  end)
+  P(co(1)); P(co(10)); P(co(20)); P(co(30))
+  P(co(100)); P(co(true)); P(co("D")); P(co("E")); P(co(false)); P(co(7))
+  local gen = coroutine.wrap(function() for i = 1, 5 do coroutine.yield(i) end end)
+  local acc = 0
+  for v in gen do acc = acc + v end
+  P("gen", acc)
+  local c2 = coroutine.create(function() error("in coro") end)
+  P(coroutine.resume(c2))
+  local c3 = coroutine.create(function() local t = nil; return t.x end)
+  P(coroutine.resume(c3))
+end
+rep("coros", coros)
+
+-- errors and debug info from compiled code
+local function errs(k)
+  E(function() local a; return a + 1 end)
+  E(function() local a = {}; return a < 1 end)
+  E(function() return {} .. "x" end)
+  E(function() local up = nil; return (function() return up.x end)() end)
+  E(function() return #nil end)
+  E(function() return 1 // 0 end)
+  E(function() return 1 % 0 end)
+  E(function() return math.tointeger(2^53) | 1.5 end)
+  E(function() error("lvl2", 2) end)
+  P(debug.traceback("tb"):gsub("0x%x+", "ADDR"))
+  local info = debug.getinfo(1, "l"); P("line", info.currentline)
+  local function where() return debug.getinfo(2, "l").currentline end
+  P("where", where())
+end
+rep("errs", errs)
+
+-- hooks turned on and off while running
+local function hooks(k)
+  local cnt = 0
+  local function work()
+    local s = 0
+    for i = 1, 1000 do s = s + i % 7 end
+    return s
+  end
+  P(work())
+  debug.sethook(function() cnt = cnt + 1 end, "", 100)
+  P(work())
+  debug.sethook()
+  P(cnt > 0)
+  local lines = {}
+  local function traced()
+    local a = 1
+    a = a + 1
+    return a
+  end
+  debug.sethook(function(ev, line) if #lines < 20 then lines[#lines + 1] = line end end, "l")
+  traced()
+  debug.sethook()
+  P(#lines > 0)
+  local calls = 0
+  debug.sethook(function(ev) calls = calls + 1 end, "cr")
+  work()
+  debug.sethook()
+  P("calls", calls)
+  -- set a count hook from inside a hot loop
+  local hit = 0
+  local s = 0
+  for i = 1, 2000 do
+    s = s + i
+    if i == 500 then debug.sethook(function() hit = hit + 1 end, "", 10) end
+  end
+  debug.sethook()
+  P(s, hit > 0)
+end
+rep("hooks", hooks)
+
+-- garbage collection while compiled code runs
+local function gc(k)
+  local keep = {}
+  for i = 1, 20000 do
+    local t = {i, tostring(i), {i}}
+    if i % 100 == 0 then keep[#keep + 1] = t end
+    if i % 5000 == 0 then collectgarbage("step", 10) end
+  end
+  collectgarbage()
+  local s = 0
+  for _, t in ipairs(keep) do s = s + t[1] + t[3][1] end
+  P("gc", s, #keep)
+  local weak = setmetatable({}, {__mode = "k"})
+  for i = 1, 100 do weak[{}] = i end
+  collectgarbage()
+  local n = 0
+  for _ in pairs(weak) do n = n + 1 end
+  P("weak", n)
+  local fin = 0
+  for i = 1, 50 do setmetatable({}, {__gc = function() fin = fin + 1 end}) end
+  collectgarbage(); collectgarbage()
+  P("fin", fin)
+end
+rep("gc", gc)
+
+-- misc instructions
+local function misc(k)
+  local a, b, c, d, e, f, g, h
+  P(a, b, c, d, e, f, g, h)
+  local x = 1 < 2
+  local y = not x
+  local z = x and 5 or 6
+  local w = y and 5 or 6
+  local v = nil or false
+  local u = false or nil
+  local q = 0 and "zero"
+  P(x, y, z, w, v, u, q)
+  if nil then P("no") elseif false then P("no") else P("yes") end
+  local n = 0
+  if n then P("0 is true") end
+  local str = ""
+  for i = 1, 20 do str = str .. i .. (i % 2 == 0 and "e" or "o") end
+  P(str)
+  P(1e15, 2^63, math.pi, -0.0, 100 // 7, 100.0 // 7, -7 // 2, -7 % 3, 7 % -3, 5.5 % 2)
+  P(3 == 3.0, math.type(3 // 1), 1 < 1.5, 2^53 == 2^53 + 1)
+  P(string.rep("ab", 3, ","), ("%5.2f"):format(3.14159))
+  local tt = {}
+  tt[1.0] = "one"; tt[2^53] = "big"
+  P(tt[1], tt[2^53])
+end
+rep("misc", misc)
+
+print(table.concat(out, "\n"))
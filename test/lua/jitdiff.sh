@@ -0,0 +1,20 @@
+#!/bin/sh
+# differential test of the JIT: runs test/lua/jit/cases.lua on the
+# interpreter and on JIT builds that compile functions on their first
+# call and at the default threshold, with assertions on, and compares
+# the outputs.
+set -e
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+BUILD=$DIR/../../build
+
+"$DIR/build.sh" "$BUILD/lua-test" -DLUAI_ASSERT "$@"
+"$DIR/build.sh" "$BUILD/lua-jit-test" -DLUAI_ASSERT -DLUA_USE_JIT=1 -DLUAI_HOTCALLS=1 "$@"
+"$DIR/build.sh" "$BUILD/lua-jit-test-hot" -DLUAI_ASSERT -DLUA_USE_JIT=1 "$@"
+
+"$BUILD/lua-test" "$DIR/jit/cases.lua" > "$BUILD/jitdiff-interpreter.txt"
+for jit in lua-jit-test lua-jit-test-hot; do
+  "$BUILD/$jit" "$DIR/jit/cases.lua" > "$BUILD/jitdiff-$jit.txt"
+  diff -u "$BUILD/jitdiff-interpreter.txt" "$BUILD/jitdiff-$jit.txt"
+done
+echo "jit ok ($(wc -l < "$BUILD/jitdiff-interpreter.txt") lines)"
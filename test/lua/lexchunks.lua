@@ -0,0 +1,93 @@
+-- the lexer scans names, blanks, comments and strings a block of input
+-- at a time (16 bytes at a time with SSE2), and the reader decides where
+-- blocks end: a chunk read in pieces of any size must compile to the
+-- same code and lines, and fail with the same message, as read whole.
+
+-- reader giving 's' in pieces of the sizes in 'sizes', in turn
+local function reader(s, sizes)
+  local i, k = 1, 0
+  return function()
+    k = k % #sizes + 1
+    local piece = s:sub(i, i + sizes[k] - 1)
+    i = i + sizes[k]
+    return piece
+  end
+end
+
+local function compile(s, r)
+  local f, err = load(r or s, "=src")
+  if f then return "ok", string.dump(f) end
+  return "error", err
+end
+
+local sizelists = {{1, 2, 3, 5, 7, 11, 13, 16, 17}, {15, 1}, {16}, {17, 16, 15}}
+for size = 1, 17 do sizelists[#sizelists + 1] = {size} end
+
+local checked = 0
+local function check(s)
+  local kind, whole = compile(s)
+  for _, sizes in ipairs(sizelists) do
+    local k, inpieces = compile(s, reader(s, sizes))
+    if k ~= kind or inpieces ~= whole then
+      error(string.format("%q in pieces of %s: %s\nwhole: %s", s,
+                          table.concat(sizes, ","), inpieces, whole), 2)
+    end
+  end
+  checked = checked + 1
+  return kind, whole
+end
+
+-- line of the end of 's', counting "\r\n" and "\n\r" as one newline
+local function lastline(s)
+  local line, i = 1, 1
+  while true do
+    local j = s:find("[\n\r]", i)
+    if not j then return line end
+    local c, d = s:sub(j, j), s:sub(j + 1, j + 1)
+    i = (d == "\n" or d == "\r") and d ~= c and j + 2 or j + 1
+    line = line + 1
+  end
+end
+
+local blanks = {" ", "\t", "\f", "\v"}
+local newlines = {"\n", "\r\n", "\r", "\n\r"}
+
+for len = 1, 40 do
+  -- names of every length, at the end of the chunk and before a
+  -- character that cannot continue them
+  local name = ("_aZ09bY"):rep(6):sub(1, len)
+  if name:find("^%d") then name = "x" .. name end
+  assert(check("return " .. name) == "ok")
+  for _, stop in ipairs({"@", "[", "`", "{", "/", ":", "\128", "\255"}) do
+    check("local " .. name .. stop .. " = 1")
+  end
+  assert(check("local t = {} t." .. name .. " = 1 return t." .. name .. "[1]") == "ok")
+
+  -- runs of blanks of every length
+  for _, b in ipairs(blanks) do
+    assert(check("local" .. b:rep(len) .. "x" .. b:rep(len) .. "=" .. b:rep(len) .. "1") == "ok")
+  end
+
+  -- comments and long strings across lines, with every kind of newline
+  for _, nl in ipairs(newlines) do
+    local text = ("c"):rep(len) .. "]" .. nl .. ("]="):rep(len % 5) .. nl
+    local src = "-- " .. ("-"):rep(len) .. nl
+             .. "--[[" .. text .. "]]" .. nl
+             .. "local s = [==[" .. nl .. text .. "]==]" .. nl
+             .. "local t = '" .. ("q"):rep(len) .. "\\z" .. nl .. "  r\\" .. nl .. "'" .. nl
+             .. "x = s .. t .. x.y"
+    assert(check(src) == "ok")
+    -- errors report the line they are on
+    local bad = src .. nl .. nl .. "local = 1"
+    local kind, err = check(bad)
+    assert(kind == "error" and err:find("^src:" .. lastline(bad) .. ":"), err)
+    kind, err = check(src .. nl .. "x = [[" .. text)
+    assert(kind == "error" and err:find("unfinished long string"), err)
+    kind, err = check(src .. nl .. "--[==[" .. text .. "]]")
+    assert(kind == "error" and err:find("unfinished long comment"), err)
+    kind, err = check(src .. nl .. "x = '" .. text)
+    assert(kind == "error" and err:find("unfinished string"), err)
+  end
+end
+
+print("lexchunks ok", checked)
@@ -0,0 +1,23 @@
+#!/bin/sh
+# run the VM tests on a standalone build of the embedded lua, with
+# assertions on, and the tests of the C API (test/lua/*.cc, each a
+# program of its own). extra arguments are passed to the compiler:
+#
+#   test/lua/run.sh [-DLUA_USE_SWISSTABLE=1 ...]
+set -e
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+LUA=$DIR/../../build/lua-test
+
+"$DIR/build.sh" "$LUA" -DLUAI_ASSERT "$@"
+
+for test in "$DIR"/*.lua; do
+  echo "$(basename "$test")"
+  (cd "$DIR" && "$LUA" "$test")
+done
+
+for test in "$DIR"/*.cc; do
+  echo "$(basename "$test")"
+  MAIN=$test "$DIR/build.sh" "${LUA%/*}/$(basename "$test" .cc)-test" -DLUAI_ASSERT "$@"
+  "${LUA%/*}/$(basename "$test" .cc)-test"
+done
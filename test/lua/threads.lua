@@ -0,0 +1,86 @@
+-- dead threads are kept and reused by lua_newthread (see luaE_freethread):
+-- a reused thread must behave like a new one.
+
+local function churn(n, f)
+  for i = 1, n do f(i) end
+  collectgarbage()
+end
+
+-- finished, suspended and failed threads, in both collector modes
+for _, mode in ipairs({"incremental", "generational"}) do
+  collectgarbage(mode)
+  local kept = {}
+  churn(2000, function(i)
+    local co = coroutine.create(function(a)
+      local x = {a}
+      kept[i % 50 + 1] = function() return x[1] end  -- upvalue outlives it
+      local b = coroutine.yield(a + 1)
+      if b == "fail" then error("failed " .. a) end
+      return a + b
+    end)
+    local ok, r = coroutine.resume(co, i)
+    assert(ok and r == i + 1)
+    if i % 3 == 0 then
+      ok, r = coroutine.resume(co, 10)
+      assert(ok and r == i + 10 and coroutine.status(co) == "dead")
+    elseif i % 3 == 1 then
+      ok, r = coroutine.resume(co, "fail")
+      assert(not ok and r:find("failed " .. i))
+    end  -- else left suspended
+  end)
+  for i = 1, 50 do assert(type(kept[i]()) == "number") end
+
+  -- a new thread starts empty, whatever the previous one left behind
+  churn(500, function(i)
+    local co = coroutine.create(function(...)
+      assert(select("#", ...) == 1)
+      local deep = 0
+      local function rec(n) if n > 0 then deep = deep + 1 return rec(n - 1) + 1 end return 0 end
+      rec(i % 100)
+      return coroutine.isyieldable(), coroutine.running() ~= nil
+    end)
+    local ok, y, r = coroutine.resume(co, i)
+    assert(ok and y == true and r == true)
+  end)
+
+  -- wrapped generators and deep stacks
+  churn(200, function(i)
+    local gen = coroutine.wrap(function()
+      local function deep(n) if n == 0 then coroutine.yield(i) else deep(n - 1) end end
+      deep(i % 150)
+    end)
+    assert(gen() == i)
+  end)
+end
+collectgarbage("incremental")
+
+-- a thread whose hook raised an error gets hooks back when reused
+local calls = 0
+churn(50, function(i)
+  local co = coroutine.create(function()
+    for j = 1, 100 do end
+  end)
+  debug.sethook(co, function()
+    calls = calls + 1
+    if i % 2 == 0 then error("hook " .. i) end
+  end, "", 10)
+  local ok, err = coroutine.resume(co)
+  assert(ok == (i % 2 == 1), err)
+end)
+local before = calls
+churn(50, function()
+  local co = coroutine.create(function() for j = 1, 100 do end end)
+  debug.sethook(co, function() calls = calls + 1 end, "", 10)
+  assert(coroutine.resume(co))
+end)
+assert(calls > before + 50, "hooks stayed off")
+
+-- threads as weak keys are dropped, not confused with their reuse
+local weak = setmetatable({}, {__mode = "k"})
+for i = 1, 100 do weak[coroutine.create(print)] = i end
+collectgarbage()
+collectgarbage()
+assert(next(weak) == nil)
+for i = 1, 100 do assert(weak[coroutine.create(print)] == nil) end
+
+print("threads ok")
@@ -0,0 +1,326 @@
+/*
+** $Id: lalloc.c $
+** Slab allocator for Lua states
+** See Copyright Notice in lua.h
+*/
+
+#define lalloc_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+
+
+/*
+** Each state created by 'luaL_newstate' has a heap of its own, so its
+** allocations take no lock and are counted apart from other states.
+** Blocks up to LUAL_SLABMAX bytes (strings, tables, nodes, closures,
+** upvalues...) are carved from large chunks, in size classes of
+** SLABQUANTUM bytes, and a freed block goes to the free list of its
+** class, for the next block of that class. Larger blocks go to
+** 'realloc'/'free', with a header linking them in a list. Lua gives the
+** size of every block it frees or resizes, so small blocks need no
+** header. The chunks go back to the system when the state is closed;
+** with 'luaL_heaprelease', so do all blocks at once.
+**
+** With 'luaL_heapdefer', freed large blocks (and the whole heap, when
+** it goes) are not given back to the system by the state's thread:
+** they are collected in batches, linked through their first word, and
+** handed to a function that frees them elsewhere ('luaL_freeblocks').
+*/
+
+#if !defined(LUAL_SLABMAX)
+#define LUAL_SLABMAX	512
+#endif
+
+#define SLABQUANTUM	16
+#define NUMCLASSES	(LUAL_SLABMAX / SLABQUANTUM)
+
+/* size class of a small block of 'sz' bytes, and size of class 'c' */
+#define sizeclass(sz)	(((sz) - 1) / SLABQUANTUM)
+#define classsize(c)	(((size_t)(c) + 1) * SLABQUANTUM)
+
+/* bytes of large blocks collected before handing them to 'defer' */
+#if !defined(LUAL_DEFERBATCH)
+#define LUAL_DEFERBATCH	(256 * 1024)
+#endif
+
+/* size of the first chunk of a heap; each next chunk doubles it */
+#define MINCHUNK	(8 * 1024)
+#define MAXCHUNK	(256 * 1024)
+
+
+typedef struct Chunk {
+  struct Chunk *previous;  /* chunk allocated before this one */
+  size_t size;
+} Chunk;
+
+
+typedef struct FreeBlock {
+  struct FreeBlock *next;
+} FreeBlock;
+
+
+typedef struct Large {
+  struct Large *previous;
+  struct Large *next;
+} Large;
+
+/* list operations on large blocks */
+#define linklarge(h,l)  \
+	((l)->previous = &(h)->large, (l)->next = (h)->large.next, \
+	 (l)->next->previous = (l), (h)->large.next = (l))
+#define fixlarge(l)	((l)->previous->next = (l), (l)->next->previous = (l))
+#define unlinklarge(l)  \
+	((l)->previous->next = (l)->next, (l)->next->previous = (l)->previous)
+
+#define largeheader(block)	(((Large *)(block)) - 1)
+
+/* link of a block in a batch of blocks to be freed */
+#define nextinbatch(b)	(*(void **)(b))
+
+
+struct luaL_Heap {
+  FreeBlock *freelist[NUMCLASSES];
+  Large large;  /* list of large blocks */
+  char *top;  /* free part of the current chunk */
+  char *limit;  /* end of the current chunk */
+  Chunk *chunks;  /* list of all chunks, newest first */
+  size_t chunksize;  /* size of the next chunk */
+  size_t inuse;  /* bytes in blocks given to Lua */
+  size_t reserved;  /* bytes in chunks and large blocks */
+  luaL_Defer defer;  /* function to free batches of blocks, or NULL */
+  void *deferud;  /* auxiliary data to 'defer' */
+  void *pending;  /* batch of large blocks not yet given to 'defer' */
+  size_t pendingsize;  /* bytes in 'pending' */
+};
+
+
+LUALIB_API void luaL_freeblocks (void *blocks) {
+  while (blocks != NULL) {
+    void *next = nextinbatch(blocks);
+    free(blocks);
+    blocks = next;
+  }
+}
+
+
+static void flushpending (luaL_Heap *h) {
+  if (h->pending != NULL) {
+    (*h->defer)(h->deferud, h->pending, h->pendingsize);
+    h->pending = NULL;
+    h->pendingsize = 0;
+  }
+}
+
+
+static void freeheap (luaL_Heap *h) {
+  void *blocks = h->pending;
+  Chunk *c = h->chunks;
+  Large *l = h->large.next;
+  while (l != &h->large) {
+    Large *next = l->next;
+    nextinbatch(l) = blocks;
+    blocks = l;
+    l = next;
+  }
+  while (c != NULL) {
+    Chunk *previous = c->previous;
+    nextinbatch(c) = blocks;
+    blocks = c;
+    c = previous;
+  }
+  if (h->defer != NULL)
+    (*h->defer)(h->deferud, blocks,
+                h->reserved - sizeof(luaL_Heap) + h->pendingsize);
+  else
+    luaL_freeblocks(blocks);
+  free(h);
+}
+
+
+static void freeblock (luaL_Heap *h, void *block, size_t size) {
+  if (size > LUAL_SLABMAX) {
+    Large *l = largeheader(block);
+    unlinklarge(l);
+    h->reserved -= sizeof(Large) + size;
+    if (h->defer == NULL)
+      free(l);
+    else {
+      nextinbatch(l) = h->pending;
+      h->pending = l;
+      h->pendingsize += sizeof(Large) + size;
+      if (h->pendingsize >= LUAL_DEFERBATCH)
+        flushpending(h);
+    }
+  }
+  else {
+    FreeBlock *b = (FreeBlock *)block;
+    int c = sizeclass(size);
+    b->next = h->freelist[c];
+    h->freelist[c] = b;
+  }
+}
+
+
+static int newchunk (luaL_Heap *h) {
+  size_t rest = h->limit - h->top;
+  Chunk *c = (Chunk *)malloc(h->chunksize);
+  if (c == NULL)
+    return 0;
+  if (rest >= SLABQUANTUM)  /* keep the end of the old chunk */
+    freeblock(h, h->top, rest - rest % SLABQUANTUM);
+  c->previous = h->chunks;
+  c->size = h->chunksize;
+  h->chunks = c;
+  h->reserved += c->size;
+  h->top = (char *)(c + 1);
+  h->limit = (char *)c + c->size;
+  if (h->chunksize < MAXCHUNK)
+    h->chunksize *= 2;
+  return 1;
+}
+
+
+static void *newblock (luaL_Heap *h, size_t size) {
+  if (size > LUAL_SLABMAX) {
+    Large *l = (Large *)malloc(sizeof(Large) + size);
+    if (l == NULL)
+      return NULL;
+    linklarge(h, l);
+    h->reserved += sizeof(Large) + size;
+    return l + 1;
+  }
+  else {
+    int c = sizeclass(size);
+    FreeBlock *b = h->freelist[c];
+    if (b != NULL)
+      h->freelist[c] = b->next;
+    else {
+      size = classsize(c);
+      if ((size_t)(h->limit - h->top) < size && !newchunk(h))
+        return NULL;
+      b = (FreeBlock *)h->top;
+      h->top += size;
+    }
+    return b;
+  }
+}
+
+
+LUALIB_API luaL_Heap *luaL_newheap (void) {
+  luaL_Heap *h = (luaL_Heap *)malloc(sizeof(luaL_Heap));
+  if (h != NULL) {
+    int i;
+    for (i = 0; i < NUMCLASSES; i++)
+      h->freelist[i] = NULL;
+    h->large.previous = h->large.next = &h->large;
+    h->top = h->limit = NULL;
+    h->chunks = NULL;
+    h->chunksize = MINCHUNK;
+    h->inuse = 0;
+    h->reserved = sizeof(luaL_Heap);
+    h->defer = NULL;
+    h->deferud = NULL;
+    h->pending = NULL;
+    h->pendingsize = 0;
+  }
+  return h;
+}
+
+
+/*
+** 'lua_Alloc' over heap 'ud'. The state's first block lives until it is
+** closed, so the heap frees itself when it has no blocks left, either
+** after the last free or when the first allocation fails.
+*/
+LUALIB_API void *luaL_heapalloc (void *ud, void *ptr, size_t osize,
+                                                      size_t nsize) {
+  luaL_Heap *h = (luaL_Heap *)ud;
+  void *block;
+  if (nsize == 0) {
+    if (ptr != NULL) {
+      freeblock(h, ptr, osize);
+      h->inuse -= osize;
+      if (h->inuse == 0)  /* state closed? */
+        freeheap(h);
+    }
+    return NULL;
+  }
+  if (ptr == NULL)
+    osize = 0;  /* 'osize' is the kind of the new object */
+  if (osize > LUAL_SLABMAX && nsize > LUAL_SLABMAX) {
+    Large *l = (Large *)realloc(largeheader(ptr), sizeof(Large) + nsize);
+    if (l == NULL)
+      return NULL;
+    fixlarge(l);  /* it may have moved */
+    h->reserved = h->reserved - osize + nsize;
+    ptr = l + 1;
+  }
+  else if (osize == 0 || osize > LUAL_SLABMAX || nsize > LUAL_SLABMAX ||
+           sizeclass(osize) != sizeclass(nsize)) {
+    block = newblock(h, nsize);
+    if (block != NULL) {
+      if (ptr != NULL) {
+        memcpy(block, ptr, (osize < nsize) ? osize : nsize);
+        freeblock(h, ptr, osize);
+      }
+      ptr = block;
+    }
+    else if (nsize > osize) {
+      if (h->inuse == 0)  /* could not create the state? */
+        freeheap(h);
+      return NULL;
+    }
+    /* else shrinking cannot fail: the block stays where it is (a large
+       one then becomes a small one, never given back to the system) */
+  }
+  h->inuse = h->inuse - osize + nsize;
+  return ptr;
+}
+
+
+/*
+** 'lua_Release' for heap 'ud': frees all its blocks and the heap itself.
+*/
+LUALIB_API void luaL_heaprelease (void *ud) {
+  freeheap((luaL_Heap *)ud);
+}
+
+
+/*
+** Set the function that frees the blocks of the heap of 'L' (NULL to
+** free them right away). Returns 0 if 'L' does not use a heap.
+*/
+LUALIB_API int luaL_heapdefer (lua_State *L, luaL_Defer f, void *ud) {
+  void *ud0;
+  luaL_Heap *h;
+  if (lua_getallocf(L, &ud0) != luaL_heapalloc)
+    return 0;  /* state does not use a heap */
+  h = (luaL_Heap *)ud0;
+  if (h->defer != NULL)
+    flushpending(h);  /* blocks collected for the old function */
+  h->defer = f;
+  h->deferud = ud;
+  return 1;
+}
+
+
+LUALIB_API int luaL_heapusage (lua_State *L, size_t *inuse, size_t *reserved) {
+  void *ud;
+  luaL_Heap *h;
+  if (lua_getallocf(L, &ud) != luaL_heapalloc)
+    return 0;  /* state does not use a heap */
+  h = (luaL_Heap *)ud;
+  if (inuse) *inuse = h->inuse;
+  if (reserved) *reserved = h->reserved;
+  return 1;
+}
+
@@ -1069,7 +1069,11 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       l_mem debt = 1;  /* =1 to signal that it did an actual step */
       lu_byte oldrunning = g->gcrunning;
       g->gcrunning = 1;  /* allow GC to run */
-      if (data == 0) {
+      if (data == 0 && ingenmode(g)) {
+        debt = 0;  /* 'luaC_genstepsmall' tells when a collection ends */
+        res = luaC_genstepsmall(L);
+      }
+      else if (data == 0) {
         luaE_setdebt(g, -GCSTEPSIZE);  /* to do a "small" step */
         luaC_step(L);
       }
@@ -1081,6 +1085,8 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcrunning = oldrunning;  /* restore previous state */
       if (debt > 0 && g->gcstate == GCSpause)  /* end of cycle? */
         res = 1;  /* signal it */
+      else if (debt > 0 && isgenerational(g))  /* did a minor collection? */
+        res = 1;
       break;
     }
     case LUA_GCSETPAUSE: {
@@ -1098,6 +1104,23 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCSETMAJORINC: {
+      res = g->gcmajormul;
+      g->gcmajormul = data;
+      break;
+    }
+    case LUA_GCGEN: {
+      res = ingenmode(g) ? LUA_GCGEN : LUA_GCINC;
+      if (data != 0)
+        g->gcminormul = data;
+      luaC_changemode(L, KGC_GEN);
+      break;
+    }
+    case LUA_GCINC: {
+      res = ingenmode(g) ? LUA_GCGEN : LUA_GCINC;
+      luaC_changemode(L, KGC_INC);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1177,7 +1200,54 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
   G(L)->ud = ud;
   G(L)->frealloc = f;
+  G(L)->release = NULL;  /* it was for the old allocator */
+  lua_unlock(L);
+}
+
+
+/*
+** With a release function, 'lua_close' does not free objects one by
+** one: it calls their finalizers and then 'f', which must free all the
+** memory the allocator has given.
+*/
+LUA_API void lua_setrelease (lua_State *L, lua_Release f) {
+  lua_lock(L);
+  G(L)->release = f;
+  lua_unlock(L);
+}
+
+
+LUA_API size_t lua_getmemlimit (lua_State *L) {
+  return G(L)->memlimit;
+}
+
+
+/*
+** Allocations that would take the state over 'limit' bytes (0 for no
+** limit) fail with a memory error, after an emergency collection, when
+** they run under a protected call. Returns the previous limit.
+*/
+LUA_API size_t lua_setmemlimit (lua_State *L, size_t limit) {
+  size_t old;
+  lua_lock(L);
+  old = G(L)->memlimit;
+  G(L)->memlimit = limit;
   lua_unlock(L);
+  return old;
+}
+
+
+/*
+** Tells whether an allocation failed on the memory limit since the
+** previous call.
+*/
+LUA_API int lua_memexceeded (lua_State *L) {
+  int res;
+  lua_lock(L);
+  res = G(L)->memexceeded;
+  G(L)->memexceeded = 0;
+  lua_unlock(L);
+  return res;
 }
 
 
@@ -1194,7 +1264,7 @@ LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
 
 
 
-static const char *aux_upvalue (StkId fi, int n, TValue **val,
+static const char *aux_upvalue (lua_State *L, StkId fi, int n, TValue **val,
                                 CClosure **owner, UpVal **uv) {
   switch (ttype(fi)) {
     case LUA_TCCL: {  /* C closure */
@@ -1209,6 +1279,7 @@ static const char *aux_upvalue (StkId fi, int n, TValue **val,
       TString *name;
       Proto *p = f->p;
       if (!(1 <= n && n <= p->sizeupvalues)) return NULL;
+      luaG_needdebug(L, p);
       *val = f->upvals[n-1]->v;
       if (uv) *uv = f->upvals[n - 1];
       name = p->upvalues[n-1].name;
@@ -1223,7 +1294,7 @@ LUA_API const char *lua_getupvalue (lua_State *L, int funcindex, int n) {
   const char *name;
   TValue *val = NULL;  /* to avoid warnings */
   lua_lock(L);
-  name = aux_upvalue(index2addr(L, funcindex), n, &val, NULL, NULL);
+  name = aux_upvalue(L, index2addr(L, funcindex), n, &val, NULL, NULL);
   if (name) {
     setobj2s(L, L->top, val);
     api_incr_top(L);
@@ -1242,7 +1313,7 @@ LUA_API const char *lua_setupvalue (lua_State *L, int funcindex, int n) {
   lua_lock(L);
   fi = index2addr(L, funcindex);
   api_checknelems(L, 1);
-  name = aux_upvalue(fi, n, &val, &owner, &uv);
+  name = aux_upvalue(L, fi, n, &val, &owner, &uv);
   if (name) {
     L->top--;
     setobj(L, val, L->top);
@@ -1023,8 +1023,14 @@ static int panic (lua_State *L) {
 }
 
 
+/*
+** States get a slab heap of their own (see 'lalloc.c'), which goes away
+** with them; 'l_alloc' is only used when the heap cannot be created.
+*/
 LUALIB_API lua_State *luaL_newstate (void) {
-  lua_State *L = lua_newstate(l_alloc, NULL);
+  luaL_Heap *h = luaL_newheap();
+  lua_State *L = (h != NULL) ? lua_newstate(luaL_heapalloc, h)
+                             : lua_newstate(l_alloc, NULL);
   if (L) lua_atpanic(L, &panic);
   return L;
 }
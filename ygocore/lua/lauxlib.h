@@ -91,6 +91,22 @@ LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
 
+/* per-state slab heaps (see 'lalloc.c') */
+typedef struct luaL_Heap luaL_Heap;
+
+LUALIB_API luaL_Heap *(luaL_newheap) (void);
+LUALIB_API void *(luaL_heapalloc) (void *ud, void *ptr, size_t osize,
+                                                        size_t nsize);
+LUALIB_API void (luaL_heaprelease) (void *ud);
+
+/* function that frees a batch of blocks, on another thread if it wants */
+typedef void (*luaL_Defer) (void *ud, void *blocks, size_t size);
+
+LUALIB_API int (luaL_heapdefer) (lua_State *L, luaL_Defer f, void *ud);
+LUALIB_API void (luaL_freeblocks) (void *blocks);
+LUALIB_API int (luaL_heapusage) (lua_State *L, size_t *inuse,
+                                               size_t *reserved);
+
 LUALIB_API lua_Integer (luaL_len) (lua_State *L, int idx);
 
 LUALIB_API const char *(luaL_gsub) (lua_State *L, const char *s, const char *p,
@@ -172,11 +172,11 @@ static int luaB_rawset (lua_State *L) {
 
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
-    "count", "step", "setpause", "setstepmul",
-    "isrunning", NULL};
+    "count", "step", "setpause", "setstepmul", "setmajorinc",
+    "isrunning", "generational", "incremental", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING};
+    LUA_GCSETMAJORINC, LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   int ex = (int)luaL_optinteger(L, 2, 0);
   int res = lua_gc(L, o, ex);
@@ -190,6 +190,10 @@ static int luaB_collectgarbage (lua_State *L) {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCGEN: case LUA_GCINC: {  /* return previous mode */
+      lua_pushstring(L, (res == LUA_GCGEN) ? "generational" : "incremental");
+      return 1;
+    }
     default: {
       lua_pushinteger(L, res);
       return 1;
@@ -284,11 +288,34 @@ static int load_aux (lua_State *L, int status, int envidx) {
 }
 
 
+/*
+** A chunk loaded with its own 'env' cannot use the frozen constants of
+** the global table, so they are hidden from the parser while it loads.
+** 'hidefrozen' leaves the frozen table on the stack and 'showfrozen'
+** takes it back from below the result of the load.
+*/
+static void hidefrozen (lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LUA_FROZENTABLE);
+  lua_pushnil(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_FROZENTABLE);
+}
+
+
+static void showfrozen (lua_State *L) {
+  lua_pushvalue(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_FROZENTABLE);
+  lua_remove(L, -2);
+}
+
+
 static int luaB_loadfile (lua_State *L) {
   const char *fname = luaL_optstring(L, 1, NULL);
   const char *mode = luaL_optstring(L, 2, NULL);
   int env = (!lua_isnone(L, 3) ? 3 : 0);  /* 'env' index or 0 if no 'env' */
-  int status = luaL_loadfilex(L, fname, mode);
+  int status;
+  if (env != 0) hidefrozen(L);
+  status = luaL_loadfilex(L, fname, mode);
+  if (env != 0) showfrozen(L);
   return load_aux(L, status, env);
 }
 
@@ -339,14 +366,17 @@ static int luaB_load (lua_State *L) {
   int env = (!lua_isnone(L, 4) ? 4 : 0);  /* 'env' index or 0 if no 'env' */
   if (s != NULL) {  /* loading a string? */
     const char *chunkname = luaL_optstring(L, 2, s);
+    if (env != 0) hidefrozen(L);
     status = luaL_loadbufferx(L, s, l, chunkname, mode);
   }
   else {  /* loading from a reader function */
     const char *chunkname = luaL_optstring(L, 2, "=(load)");
     luaL_checktype(L, 1, LUA_TFUNCTION);
     lua_settop(L, RESERVEDSLOT);  /* create reserved slot */
+    if (env != 0) hidefrozen(L);
     status = lua_load(L, generic_reader, NULL, chunkname, mode);
   }
+  if (env != 0) showfrozen(L);
   return load_aux(L, status, env);
 }
 
@@ -470,7 +470,7 @@ int luaK_stringK (FuncState *fs, TString *s) {
 */
 int luaK_intK (FuncState *fs, lua_Integer n) {
   TValue k, o;
-  setpvalue(&k, cast(void*, cast(size_t, n)));
+  setpvalue(&k, cast(void*, cast(size_t, l_castS2U(n))));
   setivalue(&o, n);
   return addk(fs, &k, &o);
 }
@@ -1201,3 +1201,35 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+/*
+** Peephole pass over a finished function: mark the instruction pairs
+** that card scripts repeat the most as superinstructions. 'Duel.Foo'
+** is GETTABUP + GETTABLE, 'c:Foo()' is SELF + CALL, and comparisons
+** against constants can skip the generic equality. Only the first
+** instruction of a pair changes, so code size, jumps, line info, and
+** debug information stay the same. Also used for loaded binary chunks,
+** so the pass first brings every opcode back to its basic form.
+*/
+void luaK_fuse (Proto *f) {
+  int pc;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction *i = &f->code[pc];
+    OpCode next = (pc + 1 < f->sizecode) ? GET_OPCODE(f->code[pc + 1])
+                                         : OP_EXTRAARG;
+    OpCode op = basicop(GET_OPCODE(*i));
+    switch (op) {
+      case OP_GETTABUP:
+        if (next == OP_GETTABLE) op = OP_GETUPFIELD;
+        break;
+      case OP_SELF:
+        if (next == OP_CALL) op = OP_SELFCALL;
+        break;
+      case OP_EQ:
+        if (ISK(GETARG_B(*i)) || ISK(GETARG_C(*i))) op = OP_EQK;
+        break;
+      default: break;
+    }
+    SET_OPCODE(*i, op);
+  }
+}
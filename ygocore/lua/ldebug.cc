@@ -21,6 +21,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -48,8 +49,10 @@ static int currentpc (CallInfo *ci) {
 }
 
 
-static int currentline (CallInfo *ci) {
-  return getfuncline(ci_func(ci)->p, currentpc(ci));
+static int currentline (lua_State *L, CallInfo *ci) {
+  Proto *p = ci_func(ci)->p;
+  luaG_needdebug(L, p);
+  return getfuncline(p, currentpc(ci));
 }
 
 
@@ -107,6 +110,14 @@ LUA_API int lua_gethookcount (lua_State *L) {
 }
 
 
+LUA_API void lua_setdebugreader (lua_State *L, lua_DebugReader f, void *ud) {
+  lua_lock(L);
+  G(L)->debugreader = f;
+  G(L)->debugud = ud;
+  lua_unlock(L);
+}
+
+
 LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
   int status;
   CallInfo *ci;
@@ -150,6 +161,7 @@ static const char *findlocal (lua_State *L, CallInfo *ci, int n,
     if (n < 0)  /* access to vararg values? */
       return findvararg(ci, -n, pos);
     else {
+      luaG_needdebug(L, ci_func(ci)->p);
       base = ci->u.l.base;
       name = luaF_getlocalname(ci_func(ci)->p, n, currentpc(ci));
     }
@@ -175,8 +187,11 @@ LUA_API const char *lua_getlocal (lua_State *L, const lua_Debug *ar, int n) {
   if (ar == NULL) {  /* information about non-active function? */
     if (!isLfunction(L->top - 1))  /* not a Lua function? */
       name = NULL;
-    else  /* consider live variables at function start (parameters) */
-      name = luaF_getlocalname(clLvalue(L->top - 1)->p, n, 0);
+    else {  /* consider live variables at function start (parameters) */
+      Proto *p = clLvalue(L->top - 1)->p;
+      luaG_needdebug(L, p);
+      name = luaF_getlocalname(p, n, 0);
+    }
   }
   else {  /* active function; get information through 'ar' */
     StkId pos = NULL;  /* to avoid warnings */
@@ -234,8 +249,11 @@ static void collectvalidlines (lua_State *L, Closure *f) {
   else {
     int i;
     TValue v;
-    int *lineinfo = f->l.p->lineinfo;
-    Table *t = luaH_new(L);  /* new table to store active lines */
+    int *lineinfo;
+    Table *t;
+    luaG_needdebug(L, f->l.p);
+    lineinfo = f->l.p->lineinfo;
+    t = luaH_new(L);  /* new table to store active lines */
     sethvalue(L, L->top, t);  /* push it on stack */
     api_incr_top(L);
     setbvalue(&v, 1);  /* boolean 'true' to be the value of all indices */
@@ -269,7 +287,7 @@ static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
         break;
       }
       case 'l': {
-        ar->currentline = (ci && isLua(ci)) ? currentline(ci) : -1;
+        ar->currentline = (ci && isLua(ci)) ? currentline(L, ci) : -1;
         break;
       }
       case 'u': {
@@ -388,7 +406,7 @@ static int findsetreg (Proto *p, int lastpc, int reg) {
   int jmptarget = 0;  /* any code before this address is conditional */
   for (pc = 0; pc < lastpc; pc++) {
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = basicop(GET_OPCODE(i));
     int a = GETARG_A(i);
     switch (op) {
       case OP_LOADNIL: {
@@ -438,7 +456,7 @@ static const char *getobjname (Proto *p, int lastpc, int reg,
   pc = findsetreg(p, lastpc, reg);
   if (pc != -1) {  /* could find instruction? */
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = basicop(GET_OPCODE(i));
     switch (op) {
       case OP_MOVE: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
@@ -494,11 +512,12 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
   Proto *p = ci_func(ci)->p;  /* calling function */
   int pc = currentpc(ci);  /* calling instruction index */
   Instruction i = p->code[pc];  /* calling instruction */
+  luaG_needdebug(L, p);
   if (ci->callstatus & CIST_HOOKED) {  /* was it called inside a hook? */
     *name = "?";
     return "hook";
   }
-  switch (GET_OPCODE(i)) {
+  switch (basicop(GET_OPCODE(i))) {
     case OP_CALL:
     case OP_TAILCALL:
       return getobjname(p, pc, GETARG_A(i), name);  /* get function name */
@@ -573,6 +592,7 @@ static const char *varinfo (lua_State *L, const TValue *o) {
   CallInfo *ci = L->ci;
   const char *kind = NULL;
   if (isLua(ci)) {
+    luaG_needdebug(L, ci_func(ci)->p);
     kind = getupvalname(ci, o, &name);  /* check whether 'o' is an upvalue */
     if (!kind && isinstack(ci, o))  /* no? try a register */
       kind = getobjname(ci_func(ci)->p, currentpc(ci),
@@ -658,7 +678,7 @@ l_noret luaG_runerror (lua_State *L, const char *fmt, ...) {
   msg = luaO_pushvfstring(L, fmt, argp);  /* format message */
   va_end(argp);
   if (isLua(ci))  /* if Lua function, add source:line information */
-    luaG_addinfo(L, msg, ci_func(ci)->p->source, currentline(ci));
+    luaG_addinfo(L, msg, ci_func(ci)->p->source, currentline(L, ci));
   luaG_errormsg(L);
 }
 
@@ -680,7 +700,9 @@ void luaG_traceexec (lua_State *L) {
   if (mask & LUA_MASKLINE) {
     Proto *p = ci_func(ci)->p;
     int npc = pcRel(ci->u.l.savedpc, p);
-    int newline = getfuncline(p, npc);
+    int newline;
+    luaG_needdebug(L, p);
+    newline = getfuncline(p, npc);
     if (npc == 0 ||  /* call linehook when enter a new function, */
         ci->u.l.savedpc <= L->oldpc ||  /* when jump back (loop), or when */
         newline != getfuncline(p, pcRel(L->oldpc, p)))  /* enter a new line */
@@ -697,3 +719,147 @@ void luaG_traceexec (lua_State *L) {
   }
 }
 
+
+/*
+** {======================================================
+** Dropped debug information
+** =======================================================
+*/
+
+typedef struct LoadS {
+  const char *s;
+  size_t size;
+} LoadS;
+
+
+static const char *getS (lua_State *L, void *ud, size_t *size) {
+  LoadS *ls = (LoadS *)ud;
+  (void)L;  /* not used */
+  if (ls->size == 0) return NULL;
+  *size = ls->size;
+  ls->size = 0;
+  return ls->s;
+}
+
+
+/*
+** Drop the debug information of a new chunk, if the debug reader can
+** give the chunk again when the information is needed.
+*/
+void luaG_dropdebug (lua_State *L, Proto *p) {
+  global_State *g = G(L);
+  size_t size;
+  if (p->source != NULL &&
+      g->debugreader(g->debugud, getstr(p->source), &size) != NULL)
+    luaF_stripdebug(L, p);
+}
+
+
+static int samecode (const Proto *p, const Proto *q) {
+  return (p->sizecode == q->sizecode &&
+          p->linedefined == q->linedefined &&
+          p->lastlinedefined == q->lastlinedefined &&
+          memcmp(p->code, q->code, p->sizecode * sizeof(Instruction)) == 0);
+}
+
+
+/* find the function of chunk 'q' compiled to the same code as 'p' */
+static Proto *findproto (Proto *q, const Proto *p) {
+  int i;
+  if (samecode(q, p))
+    return q;
+  for (i = 0; i < q->sizep; i++) {
+    Proto *r = findproto(q->p[i], p);
+    if (r != NULL)
+      return r;
+  }
+  return NULL;
+}
+
+
+/* move the debug information of 'q' (and of its nested functions) to 'p' */
+static void movedebug (lua_State *L, Proto *p, Proto *q) {
+  int i;
+  if (!p->stripped || !samecode(p, q))
+    return;
+  p->lineinfo = q->lineinfo;
+  p->sizelineinfo = q->sizelineinfo;
+  q->lineinfo = NULL;
+  q->sizelineinfo = 0;
+  p->locvars = q->locvars;
+  p->sizelocvars = q->sizelocvars;
+  q->locvars = NULL;
+  q->sizelocvars = 0;
+  for (i = 0; i < p->sizelocvars; i++) {
+    if (p->locvars[i].varname != NULL)
+      luaC_objbarrier(L, p, p->locvars[i].varname);
+  }
+  if (p->sizeupvalues == q->sizeupvalues) {
+    for (i = 0; i < p->sizeupvalues; i++) {
+      p->upvalues[i].name = q->upvalues[i].name;
+      if (p->upvalues[i].name != NULL)
+        luaC_objbarrier(L, p, p->upvalues[i].name);
+    }
+  }
+  p->stripped = 0;
+  if (p->sizep == q->sizep) {
+    for (i = 0; i < p->sizep; i++)
+      movedebug(L, p->p[i], q->p[i]);
+  }
+}
+
+
+static void newthread (lua_State *L, void *ud) {
+  *cast(lua_State **, ud) = luaE_newthread(L);
+}
+
+
+/*
+** Reload the debug information dropped from 'p' (and from the functions
+** nested in it), parsing its chunk again. Callers can hold pointers into
+** the stack of 'L', which must not move: the chunk is parsed by a new
+** thread, with a stack of its own, and the collector (which shrinks
+** stacks) is stopped meanwhile. If the chunk is gone, no longer parses or
+** no longer compiles to the code of 'p', 'p' stays without debug
+** information, as a stripped binary chunk; only a memory error (or no
+** room to anchor the new thread) leaves it to be tried again.
+*/
+void luaG_loaddebug (lua_State *L, Proto *p) {
+  global_State *g = G(L);
+  const char *chunk = NULL;
+  size_t size;
+  lu_byte running = g->gcrunning;
+  StkId top = L->top;
+  lua_State *L1;
+  int status;
+  if (L->top >= L->stack_last)  /* no room for the new thread? */
+    return;
+  if (g->debugreader != NULL)
+    chunk = g->debugreader(g->debugud, getstr(p->source), &size);
+  if (chunk == NULL) {
+    p->stripped = 0;  /* chunk is gone: do not try again */
+    return;
+  }
+  g->gcrunning = 0;
+  status = luaD_rawrunprotected(L, newthread, &L1);
+  if (status == LUA_OK) {
+    LoadS ls;
+    ZIO z;
+    ls.s = chunk;
+    ls.size = size;
+    luaZ_init(L1, &z, getS, &ls);
+    L1->nCcalls = L->nCcalls;  /* parser levels count from here */
+    status = luaD_reparse(L1, &z, getstr(p->source));
+    if (status == LUA_OK) {
+      Proto *q = findproto(clLvalue(L1->top - 1)->p, p);
+      if (q != NULL)
+        movedebug(L, p, q);
+    }
+  }
+  L->top = top;  /* remove the new thread (now garbage) */
+  g->gcrunning = running;
+  if (status != LUA_ERRMEM)
+    p->stripped = 0;  /* reloaded, or changed: do not try again */
+}
+
+/* }====================================================== */
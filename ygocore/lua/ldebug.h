@@ -17,6 +17,9 @@
 
 #define resethookcount(L)	(L->hookcount = L->basehookcount)
 
+/* reload the debug information of 'p' if it was dropped */
+#define luaG_needdebug(L,p)	{ if ((p)->stripped) luaG_loaddebug(L, p); }
+
 
 LUAI_FUNC l_noret luaG_typeerror (lua_State *L, const TValue *o,
                                                 const char *opname);
@@ -34,6 +37,8 @@ LUAI_FUNC const char *luaG_addinfo (lua_State *L, const char *msg,
                                                   TString *src, int line);
 LUAI_FUNC l_noret luaG_errormsg (lua_State *L);
 LUAI_FUNC void luaG_traceexec (lua_State *L);
+LUAI_FUNC void luaG_dropdebug (lua_State *L, Proto *p);
+LUAI_FUNC void luaG_loaddebug (lua_State *L, Proto *p);
 
 
 #endif
@@ -21,6 +21,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
@@ -54,10 +55,19 @@
 
 #if defined(__cplusplus) && !defined(LUA_USE_LONGJMP)	/* { */
 
-/* C++ exceptions */
+/*
+** C++ exceptions: unlike long jumps, they run the destructors of the
+** C++ frames they cross (e.g. in the core's library functions), and
+** cost nothing until an error is raised. A 'std::bad_alloc' thrown by
+** C++ code called from Lua becomes a memory error.
+*/
+#include <new>
+
 #define LUAI_THROW(L,c)		throw(c)
 #define LUAI_TRY(L,c,a) \
-	try { a } catch(...) { if ((c)->status == 0) (c)->status = -1; }
+	try { a } \
+	catch(std::bad_alloc&) { if ((c)->status == 0) (c)->status = LUA_ERRMEM; } \
+	catch(...) { if ((c)->status == 0) (c)->status = -1; }
 #define luai_jmpbuf		int  /* dummy variable */
 
 #elif defined(LUA_USE_POSIX)				/* }{ */
@@ -458,6 +468,7 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
       lua_assert(ci->top <= L->stack_last);
       ci->u.l.savedpc = p->code;  /* starting point */
       ci->callstatus = CIST_LUA;
+      luaJ_count(L, p);
       if (L->hookmask & LUA_MASKCALL)
         callhook(L, ci);
       return 0;
@@ -661,6 +672,7 @@ LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs) {
   luai_userstateresume(L, nargs);
   L->nny = 0;  /* allow yields */
   api_checknelems(L, (L->status == LUA_OK) ? nargs + 1 : nargs);
+  L->nprotected++;  /* errors are returned to 'from' */
   status = luaD_rawrunprotected(L, resume, &nargs);
   if (status == -1)  /* error calling 'lua_resume'? */
     status = LUA_ERRRUN;
@@ -676,6 +688,7 @@ LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs) {
     }
     else lua_assert(status == L->status);  /* normal end or yield */
   }
+  L->nprotected--;
   L->nny = oldnny;  /* restore 'nny' */
   L->nCcalls--;
   lua_assert(L->nCcalls == ((from) ? from->nCcalls : 0));
@@ -726,7 +739,9 @@ int luaD_pcall (lua_State *L, Pfunc func, void *u,
   unsigned short old_nny = L->nny;
   ptrdiff_t old_errfunc = L->errfunc;
   L->errfunc = ef;
+  L->nprotected++;
   status = luaD_rawrunprotected(L, func, u);
+  L->nprotected--;
   if (status != LUA_OK) {  /* an error occurred? */
     StkId oldtop = restorestack(L, old_top);
     luaF_close(L, oldtop);  /* close possible pending closures */
@@ -751,6 +766,7 @@ struct SParser {  /* data to 'f_parser' */
   Dyndata dyd;  /* dynamic structures used by the parser */
   const char *mode;
   const char *name;
+  int reparse;  /* keep debug information (see 'luaD_reparse') */
 };
 
 
@@ -777,6 +793,8 @@ static void f_parser (lua_State *L, void *ud) {
   }
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luaF_initupvals(L, cl);
+  if (G(L)->debugreader != NULL && !p->reparse)
+    luaG_dropdebug(L, cl->p);  /* reloaded when needed */
 }
 
 
@@ -785,7 +803,7 @@ int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
   struct SParser p;
   int status;
   L->nny++;  /* cannot yield during parsing */
-  p.z = z; p.name = name; p.mode = mode;
+  p.z = z; p.name = name; p.mode = mode; p.reparse = 0;
   p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
   p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
   p.dyd.label.arr = NULL; p.dyd.label.size = 0;
@@ -800,3 +818,28 @@ int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
 }
 
 
+/*
+** Parse a chunk again, to reload its dropped debug information (see
+** 'luaG_loaddebug'), leaving the new closure (or the error object) on
+** the stack. 'L' is a thread made for that: there is no message handler
+** and nothing to unwind.
+*/
+int luaD_reparse (lua_State *L, ZIO *z, const char *name) {
+  struct SParser p;
+  int status;
+  L->nny++;  /* cannot yield during parsing */
+  p.z = z; p.name = name; p.mode = NULL; p.reparse = 1;
+  p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
+  p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
+  p.dyd.label.arr = NULL; p.dyd.label.size = 0;
+  luaZ_initbuffer(L, &p.buff);
+  status = luaD_rawrunprotected(L, f_parser, &p);
+  luaZ_freebuffer(L, &p.buff);
+  luaM_freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
+  luaM_freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
+  luaM_freearray(L, p.dyd.label.arr, p.dyd.label.size);
+  L->nny--;
+  return status;
+}
+
+
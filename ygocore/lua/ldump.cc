@@ -15,6 +15,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -88,8 +89,13 @@ static void DumpString (const TString *s, DumpState *D) {
 
 
 static void DumpCode (const Proto *f, DumpState *D) {
+  int i;
   DumpInt(f->sizecode, D);
-  DumpVector(f->code, f->sizecode, D);
+  for (i = 0; i < f->sizecode; i++) {  /* superinstructions go as basic opcodes */
+    Instruction inst = f->code[i];
+    SET_OPCODE(inst, basicop(GET_OPCODE(inst)));
+    DumpVar(inst, D);
+  }
 }
 
 
@@ -105,6 +105,12 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+  f->icache = NULL;
+#if defined(LUA_USE_JIT)
+  f->jitcode = NULL;
+  f->jitmap = NULL;
+  f->ncalls = 0;
+#endif
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -113,6 +119,7 @@ Proto *luaF_newproto (lua_State *L) {
   f->numparams = 0;
   f->is_vararg = 0;
   f->maxstacksize = 0;
+  f->stripped = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
   f->linedefined = 0;
@@ -126,6 +133,12 @@ void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->code, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
+  if (f->icache)
+    luaM_freearray(L, f->icache, f->sizek);
+#if defined(LUA_USE_JIT)
+  if (f->jitmap)
+    luaM_freearray(L, f->jitmap, f->sizecode);
+#endif
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
@@ -133,6 +146,26 @@ void luaF_freeproto (lua_State *L, Proto *f) {
 }
 
 
+/*
+** Drop the debug information of 'f' and of the functions nested in
+** it, except their source name (see 'luaG_loaddebug').
+*/
+void luaF_stripdebug (lua_State *L, Proto *f) {
+  int i;
+  luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+  f->lineinfo = NULL;
+  f->sizelineinfo = 0;
+  luaM_freearray(L, f->locvars, f->sizelocvars);
+  f->locvars = NULL;
+  f->sizelocvars = 0;
+  for (i = 0; i < f->sizeupvalues; i++)
+    f->upvalues[i].name = NULL;
+  f->stripped = 1;
+  for (i = 0; i < f->sizep; i++)
+    luaF_stripdebug(L, f->p[i]);
+}
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
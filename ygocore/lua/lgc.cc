@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -60,10 +61,10 @@
 
 
 /*
-** 'makewhite' erases all color bits then sets only the current white
-** bit
+** 'makewhite' erases all color bits (and the old bit) then sets only
+** the current white bit
 */
-#define maskcolors	(~(bitmask(BLACKBIT) | WHITEBITS))
+#define maskcolors	(~(bit2mask(BLACKBIT, OLDBIT) | WHITEBITS))
 #define makewhite(g,x)	\
  (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
@@ -378,6 +379,8 @@ static void traverseweakvalue (global_State *g, Table *h) {
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
   else if (hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
+  else if (isgenerational(g))
+    linkgclist(h, g->grayagain);  /* revisit it in next minor collection */
 }
 
 
@@ -426,6 +429,8 @@ static int traverseephemeron (global_State *g, Table *h) {
     linkgclist(h, g->ephemeron);  /* have to propagate again */
   else if (hasclears)  /* table has white keys? */
     linkgclist(h, g->allweak);  /* may have to clean white keys */
+  else if (isgenerational(g))
+    linkgclist(h, g->grayagain);  /* revisit it in next minor collection */
   return marked;
 }
 
@@ -492,6 +497,8 @@ static int traverseproto (global_State *g, Proto *f) {
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
+                         (f->icache ? sizeof(ICache) * f->sizek : 0) +
+                         luaJ_size(f) +
                          sizeof(int) * f->sizelineinfo +
                          sizeof(LocVar) * f->sizelocvars +
                          sizeof(Upvaldesc) * f->sizeupvalues;
@@ -731,11 +738,29 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count);
 ** white; change all non-dead objects back to white, preparing for next
 ** collection cycle. Return where to continue the traversal or NULL if
 ** list is finished.
+** In generational mode, survivors keep their marks and become old.
+** As new objects are always linked at the head of a list, everything
+** after the first old object is old too, so the sweep stops there.
+** Objects still white were created after the atomic phase (the mutator
+** runs between sweep steps) and stay young; they can only be at the head
+** of 'finobj', except strings resurrected by 'internshrstr', which have
+** no references and are turned black.
 */
 static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
   global_State *g = G(L);
   int ow = otherwhite(g);
-  int white = luaC_white(g);  /* current white */
+  int toclear, toset;  /* bits to clear and to set in all live objects */
+  int tostop;  /* stop sweep when this is true */
+  if (isgenerational(g)) {  /* generational mode? */
+    toclear = ~0;  /* clear nothing */
+    toset = bitmask(OLDBIT);  /* set the old bit of all surviving objects */
+    tostop = bitmask(OLDBIT);  /* do not sweep old generation */
+  }
+  else {  /* normal mode */
+    toclear = maskcolors;  /* clear all color bits + old bit */
+    toset = luaC_white(g);  /* make object white */
+    tostop = 0;  /* do not stop */
+  }
   while (*p != NULL && count-- > 0) {
     GCObject *curr = *p;
     int marked = curr->marked;
@@ -743,8 +768,16 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
       *p = curr->next;  /* remove 'curr' from list */
       freeobj(L, curr);  /* erase 'curr' */
     }
-    else {  /* change mark to 'white' */
-      curr->marked = cast_byte((marked & maskcolors) | white);
+    else {
+      if (testbits(marked, tostop))
+        return NULL;  /* stop sweeping this list */
+      if (tostop && iswhite(curr)) {  /* young object created after atomic? */
+        if (novariant(curr->tt) == LUA_TSTRING)
+          curr->marked = cast_byte((marked & maskcolors) | bitmask(BLACKBIT) |
+                                   bitmask(OLDBIT));
+      }
+      else
+        curr->marked = cast_byte((marked & toclear) | toset);
       p = &curr->next;  /* go to next element */
     }
   }
@@ -792,6 +825,7 @@ static GCObject *udata2finalize (global_State *g) {
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
+  resetoldbit(o);  /* only young objects can be at the head of a list */
   if (issweepphase(g))
     makewhite(g, o);  /* "sweep" object */
   return o;
@@ -907,7 +941,8 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
   else {  /* move 'o' to 'finobj' list */
     GCObject **p;
     if (issweepphase(g)) {
-      makewhite(g, o);  /* "sweep" object 'o' */
+      if (!isgenerational(g))  /* (old objects keep their marks) */
+        makewhite(g, o);  /* "sweep" object 'o' */
       if (g->sweepgc == &o->next)  /* should not remove 'sweepgc' object */
         g->sweepgc = sweeptolive(L, g->sweepgc);  /* change 'sweepgc' */
     }
@@ -917,6 +952,7 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
     o->next = g->finobj;  /* link it in 'finobj' list */
     g->finobj = o;
     l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
+    resetoldbit(o);  /* only young objects can be at the head of a list */
   }
 }
 
@@ -964,26 +1000,53 @@ static void entersweep (lua_State *L) {
 }
 
 
-void luaC_freeallobjects (lua_State *L) {
+/*
+** Call the finalizers of all objects, as the state is being closed.
+*/
+void luaC_callallfinalizers (lua_State *L) {
   global_State *g = G(L);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
   callallpendingfinalizers(L);
   lua_assert(g->tobefnz == NULL);
+}
+
+
+void luaC_freeallobjects (lua_State *L) {
+  global_State *g = G(L);
+  luaC_callallfinalizers(L);
   g->currentwhite = WHITEBITS; /* this "white" makes all objects look dead */
   g->gckind = KGC_NORMAL;
+  g->gcmode = KGC_INC;  /* sweep old objects too */
   sweepwholelist(L, &g->finobj);
   sweepwholelist(L, &g->allgc);
   sweepwholelist(L, &g->fixedgc);  /* collect fixed objects */
+  luaE_freethreadpool(L);  /* and the dead threads kept by the sweeps */
   lua_assert(g->strt.nuse == 0);
 }
 
 
+/*
+** In generational mode, old objects keep their marks from one
+** collection to the next, so every gray object must remain in a gray
+** list to be revisited by the next atomic phase. Move the (already
+** cleared) weak tables from list 'l' to 'grayagain'.
+*/
+static void correctgraylist (global_State *g, GCObject **l) {
+  GCObject *o;
+  while ((o = *l) != NULL) {
+    *l = gco2t(o)->gclist;
+    linkgclist(gco2t(o), g->grayagain);
+  }
+}
+
+
 static l_mem atomic (lua_State *L) {
   global_State *g = G(L);
   l_mem work;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  g->grayagain = NULL;  /* threads and weak tables will be linked again */
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
@@ -1020,6 +1083,11 @@ static l_mem atomic (lua_State *L) {
   clearvalues(g, g->weak, origweak);
   clearvalues(g, g->allweak, origall);
   luaS_clearcache(g);
+  if (isgenerational(g)) {  /* weak tables must stay in a gray list */
+    correctgraylist(g, &g->weak);
+    correctgraylist(g, &g->allweak);
+    correctgraylist(g, &g->ephemeron);
+  }
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   work += g->GCmemtrav;  /* complete counting */
   return work;  /* estimate of memory marked by 'atomic' */
@@ -1077,7 +1145,8 @@ static lu_mem singlestep (lua_State *L) {
       return sweepstep(L, g, GCSswpend, NULL);
     }
     case GCSswpend: {  /* finish sweeps */
-      makewhite(g, g->mainthread);  /* sweep main thread */
+      if (!isgenerational(g))  /* (main thread is always old) */
+        makewhite(g, g->mainthread);  /* sweep main thread */
       checkSizes(L, g);
       g->gcstate = GCScallfin;
       return 0;
@@ -1108,6 +1177,235 @@ void luaC_runtilstate (lua_State *L, int statesmask) {
 }
 
 
+/*
+** {======================================================
+** Generational mode
+** =======================================================
+*/
+
+/*
+** Between collections the generational collector stays in state
+** 'GCSpropagate': old objects are marked (black, or gray when they are
+** threads or weak tables kept in 'grayagain'), while objects created
+** since the last collection are white. Barriers keep the invariant, so
+** a minor collection only has to traverse what was marked since then
+** and sweep the young part of each list.
+*/
+
+
+/*
+** set debt for the next minor collection, which will happen when
+** memory grows 'gcminormul'%.
+*/
+static void setminordebt (global_State *g) {
+  luaE_setdebt(g, -(cast(l_mem, (gettotalbytes(g) / 100)) * g->gcminormul));
+}
+
+
+/*
+** End a minor collection after its finalizers ran. The next one starts
+** right away, as old objects keep their marks.
+*/
+static void endyoung (global_State *g) {
+  g->gcstate = GCSpropagate;  /* skip restart; old objects keep marks */
+  g->gcremark = 0;
+  if (g->gcmajor) {  /* it ended a major collection done in steps? */
+    g->gcmajor = 0;
+    g->GCestimate = gettotalbytes(g);  /* base for next major collection */
+  }
+}
+
+
+/*
+** Minor collection: an atomic cycle over young objects. Survivors
+** become old.
+*/
+static void youngcollection (lua_State *L, global_State *g) {
+  lua_assert(g->gcstate == GCSpropagate);
+  propagateall(g);  /* traverse objects marked since last collection */
+  g->gcstate = GCSatomic;
+  luaC_runtilstate(L, bitmask(GCSpause));  /* atomic, sweep, finalizers */
+  endyoung(g);
+}
+
+
+/*
+** Major collection: turn all objects back to white (and young), then
+** run a whole cycle in generational mode, so that only survivors
+** become old again.
+*/
+static void fullgen (lua_State *L, global_State *g) {
+  g->gcmode = KGC_INC;
+  entersweep(L);  /* sweep everything to turn them back to white */
+  luaC_runtilstate(L, bitmask(GCSpause));
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new collection */
+  g->gcmode = KGC_GEN;
+  youngcollection(L, g);
+  g->GCestimate = gettotalbytes(g);  /* base for next major collection */
+}
+
+
+/*
+** Once a major collection done in steps has swept all objects back to
+** white, mark the roots and go on in generational mode: what is left is
+** a minor collection over the whole heap. Finalizers wait for its end.
+*/
+static lu_mem startmajormark (lua_State *L, global_State *g) {
+  lua_assert(g->gcmajor && g->gcstate == GCScallfin);
+  g->gcstate = GCSpause;
+  g->gcmode = KGC_GEN;
+  return singlestep(L);  /* restart collection */
+}
+
+
+/*
+** Finish a collection left halfway by 'luaC_genstepsmall'.
+*/
+static void finishgen (lua_State *L, global_State *g) {
+  lu_mem majorbase = g->GCestimate;
+  int major = g->gcmajor;
+  if (!isgenerational(g)) {  /* still sweeping to white? */
+    luaC_runtilstate(L, bitmask(GCScallfin));
+    startmajormark(L, g);
+  }
+  if (g->gcstate == GCSpropagate)
+    youngcollection(L, g);
+  else {  /* sweeping young objects */
+    luaC_runtilstate(L, bitmask(GCSpause));
+    endyoung(g);
+  }
+  if (!major)
+    g->GCestimate = majorbase;  /* preserve base value */
+}
+
+
+/*
+** true if a collection was left halfway by 'luaC_genstepsmall' (and
+** the collector is not running one of its finalizers)
+*/
+#define genhalfway(g)  \
+	(issweepphase(g) || ((g)->gcmajor && (g)->gcstate == GCSpropagate))
+
+
+/*
+** Does a minor collection, or a major one if memory grew more than
+** 'gcmajormul'% since the last major collection.
+*/
+static void genstep (lua_State *L, global_State *g) {
+  lu_mem majorbase = g->GCestimate;  /* memory after last major collection */
+  lu_mem majorinc = (majorbase / 100) * g->gcmajormul;
+  if (g->gcstate != GCSpropagate && !issweepphase(g))
+    return;  /* called from inside a collection (e.g., by a finalizer) */
+  if (genhalfway(g))
+    finishgen(L, g);
+  else if (gettotalbytes(g) > majorbase + majorinc)
+    fullgen(L, g);
+  else {
+    youngcollection(L, g);
+    g->GCestimate = majorbase;  /* preserve base value */
+  }
+  setminordebt(g);
+}
+
+
+/*
+** Does a small step of a generational collection, so that it can be
+** done in idle time with a bound ('lua_gc(L, LUA_GCSTEP, 0)'). A minor
+** collection propagates the marks made since the previous one, then
+** the objects in 'grayagain' (tables hit by back barriers, threads,
+** weak tables), which leaves little to its atomic phase; then it
+** sweeps the young objects. A major collection first sweeps all
+** objects back to white in incremental mode, then goes on as a minor
+** collection over the whole heap. The mutator may run between steps:
+** barriers keep the invariant in all phases, and any other collection
+** (by 'luaC_step' or 'luaC_fullgc') first finishes this one. Returns 1
+** when a collection (with its finalizers) completes.
+*/
+int luaC_genstepsmall (lua_State *L) {
+  global_State *g = G(L);
+  lu_mem majorbase = g->GCestimate;
+  lu_mem work = 0;
+  if (g->gcstate != GCSpropagate && !issweepphase(g))
+    return 0;  /* called from inside a collection (e.g., by a finalizer) */
+  if (!genhalfway(g) && g->gcremark == 0 &&
+      gettotalbytes(g) > majorbase + (majorbase / 100) * g->gcmajormul) {
+    g->gcmajor = 1;  /* start a major collection */
+    g->gcmode = KGC_INC;
+    entersweep(L);  /* sweep everything to turn them back to white */
+  }
+  do {
+    if (!isgenerational(g)) {  /* sweeping to white? */
+      work += singlestep(L);
+      if (g->gcstate == GCScallfin)
+        work += startmajormark(L, g);
+    }
+    else if (g->gcstate == GCSpropagate) {
+      if (g->gray == NULL && !g->gcremark) {
+        g->gray = g->grayagain;  /* traverse them now, and again... */
+        g->grayagain = NULL;  /* ...(threads, weak tables) in atomic */
+        g->gcremark = 1;
+      }
+      if (g->gray) {
+        g->GCmemtrav = 0;
+        propagatemark(g);
+        work += g->GCmemtrav;
+      }
+      else {
+        g->gcstate = GCSatomic;
+        work += singlestep(L);  /* atomic; enter sweep */
+      }
+    }
+    else {
+      work += singlestep(L);  /* sweep young objects */
+      if (g->gcstate == GCScallfin) {
+        int major = g->gcmajor;
+        luaC_runtilstate(L, bitmask(GCSpause));  /* call finalizers */
+        endyoung(g);
+        if (!major)
+          g->GCestimate = majorbase;  /* preserve base value */
+        setminordebt(g);
+        return 1;
+      }
+    }
+  } while (work < cast(lu_mem, GCSTEPSIZE));
+  if (!g->gcmajor)
+    g->GCestimate = majorbase;  /* preserve base value */
+  return 0;
+}
+
+
+/*
+** Change collector mode. Entering generational mode finishes any
+** incremental cycle and does a complete collection, so that all live
+** objects become old; leaving it sweeps all objects back to white (as
+** white has not changed, nothing will be collected).
+*/
+void luaC_changemode (lua_State *L, int newmode) {
+  global_State *g = G(L);
+  if (ingenmode(g) && genhalfway(g))
+    finishgen(L, g);
+  if (newmode == g->gcmode)
+    return;  /* nothing to change */
+  if (newmode == KGC_GEN) {
+    luaC_runtilstate(L, bitmask(GCSpause));  /* finish current cycle */
+    luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new collection */
+    g->gcmode = KGC_GEN;
+    youngcollection(L, g);
+    g->GCestimate = gettotalbytes(g);
+    setminordebt(g);
+  }
+  else {
+    g->gcmode = KGC_INC;
+    entersweep(L);
+    luaC_runtilstate(L, bitmask(GCSpause));
+    g->GCestimate = gettotalbytes(g);
+    setpause(g);
+  }
+}
+
+/* }====================================================== */
+
+
 /*
 ** get GC debt and convert it from Kb to 'work units' (avoid zero debt
 ** and overflows)
@@ -1133,6 +1431,10 @@ void luaC_step (lua_State *L) {
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  if (ingenmode(g)) {
+    genstep(L, g);
+    return;
+  }
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
@@ -1154,12 +1456,22 @@ void luaC_step (lua_State *L) {
 ** Before running the collection, check 'keepinvariant'; if it is true,
 ** there may be some objects marked as black, so the collector has
 ** to sweep all objects to turn them back to white (as white has not
-** changed, nothing will be collected).
+** changed, nothing will be collected). In generational mode, this is
+** a major collection.
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
   lua_assert(g->gckind == KGC_NORMAL);
   if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
+  if (ingenmode(g)) {
+    if (genhalfway(g))
+      finishgen(L, g);
+    if (g->gcstate == GCSpropagate)  /* not inside a collection? */
+      fullgen(L, g);
+    g->gckind = KGC_NORMAL;
+    setminordebt(g);
+    return;
+  }
   if (keepinvariant(g)) {  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   }
@@ -0,0 +1,1264 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler from Lua bytecode to native x86-64 code
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "ljit.h"
+
+#if defined(LUA_USE_JIT)
+
+#include <sys/mman.h>
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+/*
+** A function that has been called LUAI_HOTCALLS times gets native code
+** with one fragment per instruction, laid out in the order of the
+** bytecode. Simple instructions (moves, loads, jumps, tests, integer
+** arithmetic and comparisons, integer 'for' loops) work inline on the
+** stack slots, using the same 'TValue' layout as the interpreter;
+** everything else calls one of the helpers below, each doing what
+** 'luaV_execute' does for that instruction. No Lua value is kept in a
+** machine register between instructions, so every instruction boundary
+** is a place where native code can be entered or left:
+** 'luaV_execute' enters it at 'savedpc' whenever it (re)starts a frame.
+** Calls, tail calls and returns between compiled functions go straight
+** from one function's code to the other's, inside the same activation
+** of 'luaV_execute'; native code goes back to the interpreter
+** ("deoptimizes") when the next frame has no native code, and as soon
+** as a line or count hook is set.
+**
+** Errors and yields leave native code through 'longjmp' like they leave
+** the interpreter; the native frames need no cleanup.
+*/
+
+
+/* size of each block of memory for native code */
+#define JITBLOCK	(64 * 1024)
+
+/* space reserved for the code of one instruction (OP_LOADNIL may need
+   one 'mov' for each of 256 registers) */
+#define MAXFRAGMENT	(512 + 10 * (MAXARG_B + 1))
+
+
+/* x86-64 registers */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/* registers with fixed roles in native code */
+#define RL	RBX	/* 'L' */
+#define RCI	R14	/* 'ci' */
+#define RBASE	RAX	/* 'ci->u.l.base', reloaded by each instruction */
+
+/* condition codes */
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_L	0xc
+#define CC_GE	0xd
+#define CC_LE	0xe
+#define CC_G	0xf
+
+
+#define OFF_BASE	cast_int(offsetof(CallInfo, u.l.base))
+#define OFF_SAVEDPC	cast_int(offsetof(CallInfo, u.l.savedpc))
+#define OFF_FUNC	cast_int(offsetof(CallInfo, func))
+#define OFF_CI		cast_int(offsetof(lua_State, ci))
+#define OFF_HOOKMASK	cast_int(offsetof(lua_State, hookmask))
+#define OFF_TT		cast_int(offsetof(TValue, tt_))
+#define OFF_UPVALS	cast_int(offsetof(LClosure, upvals))
+#define OFF_UPVALV	cast_int(offsetof(UpVal, v))
+#define OFF_STAMP	cast_int(offsetof(Table, stamp))
+#define OFF_UDMT	cast_int(offsetof(Udata, metatable))
+#define OFF_ICT		cast_int(offsetof(ICache, t))
+#define OFF_ICSLOT	cast_int(offsetof(ICache, slot))
+#define OFF_ICSTAMP	cast_int(offsetof(ICache, stamp))
+#define OFF_ICMT	cast_int(offsetof(ICache, mt))
+#define OFF_ICMTSLOT	cast_int(offsetof(ICache, mtslot))
+#define OFF_ICMTSTAMP	cast_int(offsetof(ICache, mtstamp))
+
+/* offset of register 'r' from the base of the frame */
+#define slot(r)		(cast_int(sizeof(TValue)) * (r))
+
+
+/*
+** Memory for native code: blocks of pages, each filled by successive
+** functions and released only when the state is closed
+*/
+typedef struct JitBlock {
+  struct JitBlock *next;
+  lu_byte *mem;
+  size_t size;  /* size of 'mem' */
+  size_t used;  /* bytes already used in 'mem' */
+} JitBlock;
+
+
+/* a jump to the code of an instruction, patched once all code exists */
+typedef struct JitFix {
+  int pos;  /* position of the 32-bit displacement */
+  int pc;  /* target instruction */
+} JitFix;
+
+
+typedef struct JitState {
+  lua_State *L;
+  Proto *p;
+  lu_byte *code;  /* code being generated */
+  size_t size;  /* size of 'code' */
+  size_t n;  /* bytes used in 'code' */
+  int *map;  /* offset in 'code' of each instruction */
+  JitFix *fix;
+  int nfix;  /* number of entries in 'fix' */
+  int sizefix;  /* size of 'fix' */
+  int exit[3];  /* offsets of the code returning each JIT_* result */
+} JitState;
+
+
+/* helpers called by native code */
+typedef int (*Helper) (lua_State *L, CallInfo *ci, const Instruction *pc);
+
+/*
+** helpers that may change frames: they return the native code where
+** execution goes on in 'L->ci', or a JIT_* result to leave native code
+** (JIT_DEOPT here means to go on with the next instruction)
+*/
+typedef size_t (*Linker) (lua_State *L, CallInfo *ci, const Instruction *pc);
+
+/* native code of a function */
+typedef int (*JitFunction) (lua_State *L, CallInfo *ci, const lu_byte *entry);
+
+
+
+/*
+** {======================================================
+** Helpers
+** =======================================================
+*/
+
+#define RA(i)	(ci->u.l.base + GETARG_A(i))
+#define RB(i)	(ci->u.l.base + GETARG_B(i))
+#define RK(x)	(ISK(x) ? clLvalue(ci->func)->p->k + INDEXK(x) \
+                        : ci->u.l.base + (x))
+#define RKB(i)	RK(GETARG_B(i))
+#define RKC(i)	RK(GETARG_C(i))
+
+/* make the instruction at 'pc' the current one (as after 'vmfetch') */
+#define savepc(ci,pc)	((ci)->u.l.savedpc = (pc) + 1)
+
+#define checkGC(L,c)  \
+	{ luaC_condGC(L, L->top = (c), L->top = ci->top); \
+	  luai_threadyield(L); }
+
+
+static void gettable (lua_State *L, CallInfo *ci, Instruction i,
+                      const TValue *t) {
+  TValue *rc = RKC(i);
+  const TValue *slot;
+  if (ISK(GETARG_C(i)) && ttisshrstring(rc) &&
+      (slot = luaV_icget(L, clLvalue(ci->func)->p, t,
+                         INDEXK(GETARG_C(i)))) != NULL)
+    { setobj2s(L, RA(i), slot); }
+  else if (luaV_fastget(L, t, rc, slot, luaH_get))
+    { setobj2s(L, RA(i), slot); }
+  else luaV_finishget(L, t, rc, RA(i), slot);
+}
+
+
+static int h_gettabup (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  gettable(L, ci, i, clLvalue(ci->func)->upvals[GETARG_B(i)]->v);
+  return 0;
+}
+
+
+static int h_gettable (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  gettable(L, ci, i, RB(i));
+  return 0;
+}
+
+
+static void settable (lua_State *L, const TValue *t, TValue *key,
+                      TValue *val) {
+  const TValue *slot;
+  if (!luaV_fastset(L, t, key, slot, luaH_get, val))
+    luaV_finishset(L, t, key, val, slot);
+}
+
+
+static int h_settabup (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  settable(L, clLvalue(ci->func)->upvals[GETARG_A(i)]->v, RKB(i), RKC(i));
+  return 0;
+}
+
+
+static int h_setupval (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  UpVal *uv = clLvalue(ci->func)->upvals[GETARG_B(i)];
+  savepc(ci, pc);
+  setobj(L, uv->v, RA(i));
+  luaC_upvalbarrier(L, uv);
+  return 0;
+}
+
+
+static int h_settable (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  settable(L, RA(i), RKB(i), RKC(i));
+  return 0;
+}
+
+
+static int h_newtable (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  StkId ra = RA(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  Table *t;
+  savepc(ci, pc);
+  t = luaH_new(L);
+  sethvalue(L, ra, t);
+  if (b != 0 || c != 0)
+    luaH_resize(L, t, luaO_fb2int(b), luaO_fb2int(c));
+  checkGC(L, ra + 1);
+  return 0;
+}
+
+
+static int h_self (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  StkId ra = RA(i);
+  StkId rb = RB(i);
+  TValue *rc = RKC(i);
+  TString *key = tsvalue(rc);  /* key must be a string */
+  const TValue *aux;
+  savepc(ci, pc);
+  setobjs2s(L, ra + 1, rb);
+  if (ISK(GETARG_C(i)) && ttisshrstring(rc) &&
+      (aux = luaV_icget(L, clLvalue(ci->func)->p, rb,
+                        INDEXK(GETARG_C(i)))) != NULL) {
+    setobj2s(L, ra, aux);
+  }
+  else if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
+    setobj2s(L, ra, aux);
+  }
+  else luaV_finishget(L, rb, rc, ra, aux);
+  return 0;
+}
+
+
+/* binary arithmetic and bitwise operators (same order as in 'lua.h') */
+static int h_arith (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  luaO_arith(L, GET_OPCODE(i) - OP_ADD + LUA_OPADD, RKB(i), RKC(i), RA(i));
+  return 0;
+}
+
+
+static int h_unary (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  luaO_arith(L, GET_OPCODE(i) - OP_ADD + LUA_OPADD, RB(i), RB(i), RA(i));
+  return 0;
+}
+
+
+static int h_not (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  int res = l_isfalse(RB(i));  /* next assignment may change this value */
+  UNUSED(L);
+  savepc(ci, pc);
+  setbvalue(RA(i), res);
+  return 0;
+}
+
+
+static int h_len (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  luaV_objlen(L, RA(i), RB(i));
+  return 0;
+}
+
+
+static int h_concat (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  StkId ra, rb;
+  savepc(ci, pc);
+  L->top = ci->u.l.base + c + 1;  /* mark the end of concat operands */
+  luaV_concat(L, c - b + 1);
+  ra = RA(i);  /* 'luaV_concat' may invoke TMs and move the stack */
+  rb = ci->u.l.base + b;
+  setobjs2s(L, ra, rb);
+  checkGC(L, (ra >= rb ? ra + 1 : rb));
+  L->top = ci->top;  /* restore top */
+  return 0;
+}
+
+
+/* a jump that closes upvalues */
+static int h_jmp (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  luaF_close(L, ci->u.l.base + GETARG_A(i) - 1);
+  return 0;
+}
+
+
+/*
+** finish a test instruction: if 'cond', do the jump that follows it;
+** otherwise skip that jump. Return 'cond'.
+*/
+static int condjump (lua_State *L, CallInfo *ci, const Instruction *pc,
+                     int cond) {
+  if (cond) {
+    Instruction j = pc[1];
+    int a = GETARG_A(j);
+    if (a != 0) luaF_close(L, ci->u.l.base + a - 1);
+    ci->u.l.savedpc = pc + 2 + GETARG_sBx(j);
+  }
+  else
+    ci->u.l.savedpc = pc + 2;
+  return cond;
+}
+
+
+static int h_eq (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  return condjump(L, ci, pc,
+                  luaV_equalobj(L, RKB(i), RKC(i)) == GETARG_A(i));
+}
+
+
+static int h_eqk (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  return condjump(L, ci, pc,
+                  luaV_equalobj(NULL, RKB(i), RKC(i)) == GETARG_A(i));
+}
+
+
+static int h_lt (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  return condjump(L, ci, pc,
+                  luaV_lessthan(L, RKB(i), RKC(i)) == GETARG_A(i));
+}
+
+
+static int h_le (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  return condjump(L, ci, pc,
+                  luaV_lessequal(L, RKB(i), RKC(i)) == GETARG_A(i));
+}
+
+
+/* where to go on running frame 'ci' (after a call or return) */
+static size_t resume (lua_State *L, CallInfo *ci) {
+  Proto *p = clLvalue(ci->func)->p;
+  if (p->jitcode == NULL || (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)))
+    return JIT_NEWFRAME;
+  return cast(size_t, p->jitcode + p->jitmap[ci->u.l.savedpc - p->code]);
+}
+
+
+static size_t h_call (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  StkId ra = RA(i);
+  int b = GETARG_B(i);
+  int nresults = GETARG_C(i) - 1;
+  savepc(ci, pc);
+  if (b != 0) L->top = ra+b;  /* else previous instruction set top */
+  if (luaD_precall(L, ra, nresults)) {  /* C function? */
+    if (nresults >= 0)
+      L->top = ci->top;  /* adjust results */
+    return JIT_DEOPT;
+  }
+  return resume(L, L->ci);  /* Lua function */
+}
+
+
+static size_t h_tailcall (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  StkId ra = RA(i);
+  int b = GETARG_B(i);
+  savepc(ci, pc);
+  if (b != 0) L->top = ra+b;  /* else previous instruction set top */
+  lua_assert(GETARG_C(i) - 1 == LUA_MULTRET);
+  if (luaD_precall(L, ra, LUA_MULTRET))  /* C function? */
+    return JIT_DEOPT;
+  else {
+    /* tail call: put called frame (n) in place of caller one (o) */
+    CallInfo *nci = L->ci;  /* called frame */
+    CallInfo *oci = nci->previous;  /* caller frame */
+    StkId nfunc = nci->func;  /* called function */
+    StkId ofunc = oci->func;  /* caller function */
+    /* last stack slot filled by 'precall' */
+    StkId lim = nci->u.l.base + getproto(nfunc)->numparams;
+    int aux;
+    /* close all upvalues from previous call */
+    if (getproto(ofunc)->sizep > 0) luaF_close(L, oci->u.l.base);
+    /* move new frame into old one */
+    for (aux = 0; nfunc + aux < lim; aux++)
+      setobjs2s(L, ofunc + aux, nfunc + aux);
+    oci->u.l.base = ofunc + (nci->u.l.base - nfunc);  /* correct base */
+    oci->top = L->top = ofunc + (L->top - nfunc);  /* correct top */
+    oci->u.l.savedpc = nci->u.l.savedpc;
+    oci->callstatus |= CIST_TAIL;  /* function was tail called */
+    L->ci = oci;  /* remove new frame */
+    lua_assert(L->top == oci->u.l.base + getproto(ofunc)->maxstacksize);
+    return resume(L, oci);
+  }
+}
+
+
+static size_t h_return (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  StkId ra = RA(i);
+  int b = GETARG_B(i);
+  savepc(ci, pc);
+  if (getproto(ci->func)->sizep > 0) luaF_close(L, ci->u.l.base);
+  b = luaD_poscall(L, ci, ra, (b != 0 ? b - 1 : cast_int(L->top - ra)));
+  if (ci->callstatus & CIST_FRESH)  /* 'ci' was started by luaV_execute? */
+    return JIT_RETURN;
+  ci = L->ci;
+  if (b) L->top = ci->top;
+  lua_assert(isLua(ci));
+  lua_assert(GET_OPCODE(*((ci)->u.l.savedpc - 1)) == OP_CALL);
+  return resume(L, ci);
+}
+
+
+/* floating 'for' loop (integer loops are done inline) */
+static int h_forloop (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  StkId ra = RA(i);
+  lua_Number step = fltvalue(ra + 2);
+  lua_Number idx = luai_numadd(L, fltvalue(ra), step); /* inc. index */
+  lua_Number limit = fltvalue(ra + 1);
+  UNUSED(L);
+  savepc(ci, pc);
+  if (luai_numlt(0, step) ? luai_numle(idx, limit)
+                          : luai_numle(limit, idx)) {
+    ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+    chgfltvalue(ra, idx);  /* update internal index... */
+    setfltvalue(ra + 3, idx);  /* ...and external index */
+    return 1;
+  }
+  return 0;
+}
+
+
+static int h_forprep (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  savepc(ci, pc);
+  luaV_forprep(L, RA(i));
+  return 0;
+}
+
+
+static int h_tforcall (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  StkId ra = RA(i);
+  StkId cb = ra + 3;  /* call base */
+  savepc(ci, pc);
+  setobjs2s(L, cb+2, ra+2);
+  setobjs2s(L, cb+1, ra+1);
+  setobjs2s(L, cb, ra);
+  L->top = cb + 3;  /* func. + 2 args (state and index) */
+  luaD_call(L, cb, GETARG_C(i));
+  L->top = ci->top;
+  return 0;
+}
+
+
+static int h_setlist (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  StkId ra = RA(i);
+  int n = GETARG_B(i);
+  int c = GETARG_C(i);
+  unsigned int last;
+  Table *h;
+  savepc(ci, pc);
+  if (n == 0) n = cast_int(L->top - ra) - 1;
+  if (c == 0) {
+    lua_assert(GET_OPCODE(pc[1]) == OP_EXTRAARG);
+    c = GETARG_Ax(*ci->u.l.savedpc++);
+  }
+  h = hvalue(ra);
+  last = ((c-1)*LFIELDS_PER_FLUSH) + n;
+  if (last > h->sizearray)  /* needs more space? */
+    luaH_resizearray(L, h, last);  /* preallocate it at once */
+  for (; n > 0; n--) {
+    TValue *val = ra+n;
+    luaH_setint(L, h, last--, val);
+    luaC_barrierback(L, h, val);
+  }
+  L->top = ci->top;  /* correct top (in case of previous open call) */
+  return 0;
+}
+
+
+static int h_closure (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  LClosure *cl = clLvalue(ci->func);
+  StkId ra = RA(i);
+  savepc(ci, pc);
+  luaV_closure(L, cl->p->p[GETARG_Bx(i)], cl, ci->u.l.base, ra);
+  checkGC(L, ra + 1);
+  return 0;
+}
+
+
+static int h_vararg (lua_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  StkId base = ci->u.l.base;
+  StkId ra;
+  int b = GETARG_B(i) - 1;  /* required results */
+  int j;
+  int n = cast_int(base - ci->func) - clLvalue(ci->func)->p->numparams - 1;
+  savepc(ci, pc);
+  if (n < 0)  /* less arguments than parameters? */
+    n = 0;  /* no vararg arguments */
+  if (b < 0) {  /* B == 0? */
+    b = n;  /* get all var. arguments */
+    luaD_checkstack(L, n);
+    base = ci->u.l.base;  /* previous call may change the stack */
+    L->top = base + GETARG_A(i) + n;
+  }
+  ra = base + GETARG_A(i);
+  for (j = 0; j < b && j < n; j++)
+    setobjs2s(L, ra + j, base - n + j);
+  for (; j < b; j++)  /* complete required results with nil */
+    setnilvalue(ra + j);
+  return 0;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Code emission
+** =======================================================
+*/
+
+static void emit8 (JitState *J, int b) {
+  J->code[J->n++] = cast_byte(b);
+}
+
+
+static void emit32 (JitState *J, int v) {
+  memcpy(J->code + J->n, &v, 4);
+  J->n += 4;
+}
+
+
+static void emit64 (JitState *J, size_t v) {
+  memcpy(J->code + J->n, &v, 8);
+  J->n += 8;
+}
+
+
+/* REX prefix, if needed, for operand size 'w' and registers 'r', 'm' */
+static void rex (JitState *J, int w, int r, int m) {
+  int x = (w ? 8 : 0) | ((r & 8) >> 1) | ((m & 8) >> 3);
+  if (x != 0)
+    emit8(J, 0x40 | x);
+}
+
+
+static void opcode (JitState *J, int op) {
+  if (op > 0xff)  /* two-byte opcode? */
+    emit8(J, op >> 8);
+  emit8(J, op & 0xff);
+}
+
+
+/* instruction 'op' with register 'r' and memory operand '[m + d]' */
+static void oprm (JitState *J, int w, int op, int r, int m, int d) {
+  int disp8 = (-128 <= d && d <= 127);
+  rex(J, w, r, m);
+  opcode(J, op);
+  emit8(J, (disp8 ? 0x40 : 0x80) | ((r & 7) << 3) | (m & 7));
+  if ((m & 7) == RSP)  /* RSP and R12 as base need a SIB byte */
+    emit8(J, 0x24);
+  if (disp8) emit8(J, d & 0xff);
+  else emit32(J, d);
+}
+
+
+/* instruction 'op' with registers 'r' (in ModRM.reg) and 'm' */
+static void oprr (JitState *J, int w, int op, int r, int m) {
+  rex(J, w, r, m);
+  opcode(J, op);
+  emit8(J, 0xc0 | ((r & 7) << 3) | (m & 7));
+}
+
+
+/* mov r, imm64 */
+static void movimm (JitState *J, int r, size_t v) {
+  rex(J, 1, 0, r);
+  emit8(J, 0xb8 | (r & 7));
+  emit64(J, v);
+}
+
+
+static void loadbase (JitState *J) {
+  oprm(J, 1, 0x8b, RBASE, RCI, OFF_BASE);  /* mov rax, ci->u.l.base */
+}
+
+
+/* copy the 'TValue' at '[s + sd]' to '[d + dd]' */
+static void copyvalue (JitState *J, int d, int dd, int s, int sd) {
+  oprm(J, 0, 0x0f10, 0, s, sd);  /* movups xmm0, [s + sd] */
+  oprm(J, 0, 0x0f11, 0, d, dd);  /* movups [d + dd], xmm0 */
+}
+
+
+static void settag (JitState *J, int m, int d, int tag) {
+  oprm(J, 0, 0xc7, 0, m, d + OFF_TT);  /* mov dword [m + d + tt], tag */
+  emit32(J, tag);
+}
+
+
+static void cmptag (JitState *J, int m, int d, int tag) {
+  lua_assert(tag < 0x80);
+  oprm(J, 0, 0x83, 7, m, d + OFF_TT);  /* cmp dword [m + d + tt], tag */
+  emit8(J, tag);
+}
+
+
+/* jump with condition 'cc' (or always, if 'cc' < 0) to be patched */
+static int jump (JitState *J, int cc) {
+  if (cc < 0)
+    emit8(J, 0xe9);
+  else {
+    emit8(J, 0x0f);
+    emit8(J, 0x80 | cc);
+  }
+  emit32(J, 0);
+  return cast_int(J->n) - 4;
+}
+
+
+static void patchto (JitState *J, int pos, int target) {
+  int rel = target - (pos + 4);
+  memcpy(J->code + pos, &rel, 4);
+}
+
+
+/* make the jump at 'pos' go to the current position */
+static void patchhere (JitState *J, int pos) {
+  patchto(J, pos, cast_int(J->n));
+}
+
+
+/* jump with condition 'cc' to the code of instruction 'pc' */
+static void jumppc (JitState *J, int cc, int pc) {
+  lua_assert(0 <= pc && pc < J->p->sizecode);
+  lua_assert(J->nfix < J->sizefix);
+  J->fix[J->nfix].pos = jump(J, cc);
+  J->fix[J->nfix++].pc = pc;
+}
+
+
+/* call function at address 'f' with arguments L, ci and the 'pc' */
+static void callhelper (JitState *J, size_t f, int pc) {
+  oprr(J, 1, 0x89, RL, RDI);  /* mov rdi, L */
+  oprr(J, 1, 0x89, RCI, RSI);  /* mov rsi, ci */
+  movimm(J, RDX, cast(size_t, J->p->code + pc));
+  movimm(J, RAX, f);
+  oprr(J, 0, 0xff, 2, RAX);  /* call rax */
+}
+
+
+/* leave native code if a line or count hook has been set */
+static void hookcheck (JitState *J) {
+  oprm(J, 0, 0xf7, 0, RL, OFF_HOOKMASK);  /* test L->hookmask, ... */
+  emit32(J, LUA_MASKLINE | LUA_MASKCOUNT);
+  patchto(J, jump(J, CC_NE), J->exit[JIT_DEOPT]);
+}
+
+
+/* call helper 'f'; 'run' tells whether it can run Lua code */
+static void helper (JitState *J, Helper f, int pc, int run) {
+  callhelper(J, cast(size_t, f), pc);
+  if (run)
+    hookcheck(J);
+}
+
+
+/* call linker 'f' and go where it says */
+static void chain (JitState *J, Linker f, int pc) {
+  int exits;
+  callhelper(J, cast(size_t, f), pc);
+  oprr(J, 1, 0x83, 7, RAX);  /* cmp rax, JIT_RETURN */
+  emit8(J, JIT_RETURN);
+  exits = jump(J, CC_BE);
+  oprm(J, 1, 0x8b, RCI, RL, OFF_CI);  /* mov ci, L->ci */
+  oprr(J, 0, 0xff, 4, RAX);  /* jmp rax */
+  patchhere(J, exits);
+  oprr(J, 0, 0x83, 7, RAX);  /* cmp eax, JIT_NEWFRAME */
+  emit8(J, JIT_NEWFRAME);
+  patchto(J, jump(J, CC_E), J->exit[JIT_NEWFRAME]);
+  patchto(J, jump(J, CC_A), J->exit[JIT_RETURN]);
+  hookcheck(J);  /* JIT_DEOPT: next instruction (after a C function) */
+}
+
+
+/*
+** Entry and exits. Native code is called as a 'JitFunction'; it keeps
+** 'L' and 'ci' in callee-saved registers, jumps to the given entry and
+** returns through one of the exits.
+*/
+static void prologue (JitState *J) {
+  int epilogue;
+  emit8(J, 0x55);  /* push rbp */
+  oprr(J, 1, 0x89, RSP, RBP);  /* mov rbp, rsp */
+  emit8(J, 0x53);  /* push rbx */
+  emit8(J, 0x41); emit8(J, 0x56);  /* push r14 (stack now aligned) */
+  oprr(J, 1, 0x89, RDI, RL);  /* mov rbx, rdi */
+  oprr(J, 1, 0x89, RSI, RCI);  /* mov r14, rsi */
+  oprr(J, 0, 0xff, 4, RDX);  /* jmp rdx */
+  J->exit[JIT_DEOPT] = cast_int(J->n);
+  oprr(J, 0, 0x31, RAX, RAX);  /* xor eax, eax */
+  epilogue = cast_int(J->n);
+  emit8(J, 0x41); emit8(J, 0x5e);  /* pop r14 */
+  emit8(J, 0x5b);  /* pop rbx */
+  emit8(J, 0x5d);  /* pop rbp */
+  emit8(J, 0xc3);  /* ret */
+  J->exit[JIT_NEWFRAME] = cast_int(J->n);
+  emit8(J, 0xb8); emit32(J, JIT_NEWFRAME);  /* mov eax, JIT_NEWFRAME */
+  patchto(J, jump(J, -1), epilogue);
+  J->exit[JIT_RETURN] = cast_int(J->n);
+  emit8(J, 0xb8); emit32(J, JIT_RETURN);  /* mov eax, JIT_RETURN */
+  patchto(J, jump(J, -1), epilogue);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Instructions
+** =======================================================
+*/
+
+/* whether RK operand 'x' can be an integer (a register or an integer K) */
+static int intoperand (Proto *p, int x) {
+  return !ISK(x) || ttisinteger(&p->k[INDEXK(x)]);
+}
+
+
+/*
+** load integer operand 'x' into 'r'; if it is a register that does not
+** hold an integer, jump to a slow path (added to 'slow')
+*/
+static void loadint (JitState *J, int x, int r, int *slow, int *nslow) {
+  if (ISK(x))
+    movimm(J, r, l_castS2U(ivalue(&J->p->k[INDEXK(x)])));
+  else {
+    cmptag(J, RBASE, slot(x), LUA_TNUMINT);
+    slow[(*nslow)++] = jump(J, CC_NE);
+    oprm(J, 1, 0x8b, r, RBASE, slot(x));  /* mov r, [base + x] */
+  }
+}
+
+
+/* load 'cl->upvals[b]->v' into 'r' */
+static void loadupval (JitState *J, int r, int b) {
+  oprm(J, 1, 0x8b, r, RCI, OFF_FUNC);  /* mov r, ci->func */
+  oprm(J, 1, 0x8b, r, r, 0);  /* mov r, clLvalue(r) */
+  oprm(J, 1, 0x8b, r, r, OFF_UPVALS + b * cast_int(sizeof(UpVal *)));
+  oprm(J, 1, 0x8b, r, r, OFF_UPVALV);
+}
+
+
+/* whether the key of 'i' is a constant with an inline cache */
+static int cached (Proto *p, Instruction i) {
+  return ISK(GETARG_C(i)) && ttisshrstring(&p->k[INDEXK(GETARG_C(i))]) &&
+         p->icache != NULL;
+}
+
+
+/*
+** Inline cache hit (see 'luaV_icget') of 'i', for the table or userdata
+** at '[t + td]': copy the cached value to R(A), or jump to the slow path
+*/
+static void cachedget (JitState *J, Instruction i, int t, int td,
+                       int *slow, int *nslow) {
+  ICache *ic = &J->p->icache[INDEXK(GETARG_C(i))];
+  int notable, found;
+  oprm(J, 0, 0x8b, RDX, t, td + OFF_TT);  /* mov edx, tag */
+  oprm(J, 1, 0x8b, R8, t, td);  /* mov r8, gcvalue */
+  movimm(J, R9, cast(size_t, ic));
+  oprr(J, 0, 0x83, 7, RDX);  /* cmp edx, table */
+  emit8(J, ctb(LUA_TTABLE));
+  notable = jump(J, CC_NE);
+  oprm(J, 1, 0x3b, R8, R9, OFF_ICT);  /* cmp r8, ic->t */
+  slow[(*nslow)++] = jump(J, CC_NE);
+  found = jump(J, -1);
+  patchhere(J, notable);
+  oprr(J, 0, 0x83, 7, RDX);  /* cmp edx, full userdata */
+  emit8(J, ctb(LUA_TUSERDATA));
+  slow[(*nslow)++] = jump(J, CC_NE);
+  oprm(J, 1, 0x8b, R8, R8, OFF_UDMT);  /* mov r8, metatable */
+  oprr(J, 1, 0x85, R8, R8);  /* test r8, r8 */
+  slow[(*nslow)++] = jump(J, CC_E);
+  oprm(J, 1, 0x3b, R8, R9, OFF_ICMT);  /* cmp r8, ic->mt */
+  slow[(*nslow)++] = jump(J, CC_NE);
+  oprm(J, 1, 0x8b, R10, R8, OFF_STAMP);  /* mov r10, mt->stamp */
+  oprm(J, 1, 0x3b, R10, R9, OFF_ICMTSTAMP);  /* cmp r10, ic->mtstamp */
+  slow[(*nslow)++] = jump(J, CC_NE);
+  oprm(J, 1, 0x8b, R10, R9, OFF_ICMTSLOT);  /* mov r10, ic->mtslot */
+  cmptag(J, R10, 0, ctb(LUA_TTABLE));
+  slow[(*nslow)++] = jump(J, CC_NE);
+  oprm(J, 1, 0x8b, R8, R10, 0);  /* mov r8, hvalue(mtslot) */
+  oprm(J, 1, 0x3b, R8, R9, OFF_ICT);  /* cmp r8, ic->t */
+  slow[(*nslow)++] = jump(J, CC_NE);
+  patchhere(J, found);  /* r8 is 'ic->t' */
+  oprm(J, 1, 0x8b, R10, R8, OFF_STAMP);  /* mov r10, h->stamp */
+  oprm(J, 1, 0x3b, R10, R9, OFF_ICSTAMP);  /* cmp r10, ic->stamp */
+  slow[(*nslow)++] = jump(J, CC_NE);
+  oprm(J, 1, 0x8b, R10, R9, OFF_ICSLOT);  /* mov r10, ic->slot */
+  cmptag(J, R10, 0, LUA_TNIL);
+  slow[(*nslow)++] = jump(J, CC_E);
+  copyvalue(J, RBASE, slot(GETARG_A(i)), R10, 0);
+}
+
+
+/* a table access: the inline cache hit when possible, else the helper */
+static void gettab (JitState *J, int pc, Instruction i, Helper f) {
+  if (cached(J->p, i)) {
+    int slow[10];
+    int nslow = 0;
+    int done;
+    loadbase(J);
+    switch (GET_OPCODE(i)) {
+      case OP_GETTABUP: case OP_GETUPFIELD: {
+        loadupval(J, RCX, GETARG_B(i));
+        cachedget(J, i, RCX, 0, slow, &nslow);
+        break;
+      }
+      case OP_SELF: case OP_SELFCALL: {
+        int a = GETARG_A(i);
+        copyvalue(J, RBASE, slot(a + 1), RBASE, slot(GETARG_B(i)));
+        cachedget(J, i, RBASE, slot(GETARG_B(i)), slow, &nslow);
+        break;
+      }
+      default: {  /* OP_GETTABLE */
+        cachedget(J, i, RBASE, slot(GETARG_B(i)), slow, &nslow);
+        break;
+      }
+    }
+    done = jump(J, -1);
+    while (nslow > 0)
+      patchhere(J, slow[--nslow]);
+    helper(J, f, pc, 1);
+    patchhere(J, done);
+  }
+  else
+    helper(J, f, pc, 1);
+}
+
+
+static void arith (JitState *J, int pc, Instruction i) {
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  if (intoperand(J->p, b) && intoperand(J->p, c)) {
+    int slow[2];
+    int nslow = 0;
+    int done;
+    loadbase(J);
+    loadint(J, b, RCX, slow, &nslow);
+    loadint(J, c, RDX, slow, &nslow);
+    switch (GET_OPCODE(i)) {
+      case OP_ADD: oprr(J, 1, 0x01, RDX, RCX); break;  /* add rcx, rdx */
+      case OP_SUB: oprr(J, 1, 0x29, RDX, RCX); break;  /* sub rcx, rdx */
+      case OP_MUL: oprr(J, 1, 0x0faf, RCX, RDX); break;  /* imul rcx, rdx */
+      case OP_BAND: oprr(J, 1, 0x21, RDX, RCX); break;  /* and rcx, rdx */
+      case OP_BOR: oprr(J, 1, 0x09, RDX, RCX); break;  /* or rcx, rdx */
+      case OP_BXOR: oprr(J, 1, 0x31, RDX, RCX); break;  /* xor rcx, rdx */
+      default: lua_assert(0);
+    }
+    oprm(J, 1, 0x89, RCX, RBASE, slot(GETARG_A(i)));
+    settag(J, RBASE, slot(GETARG_A(i)), LUA_TNUMINT);
+    done = jump(J, -1);
+    while (nslow > 0)
+      patchhere(J, slow[--nslow]);
+    helper(J, h_arith, pc, 1);
+    patchhere(J, done);
+  }
+  else
+    helper(J, h_arith, pc, 1);
+}
+
+
+/*
+** Comparisons. If the result is different from A, skip the jump that
+** follows; otherwise do it (falling into its code on the fast path, as
+** helpers already do the jump themselves).
+*/
+static void compare (JitState *J, int pc, Instruction i, Helper f) {
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  int a = GETARG_A(i);
+  int target = pc + 2 + GETARG_sBx(J->p->code[pc + 1]);
+  lua_assert(GET_OPCODE(J->p->code[pc + 1]) == OP_JMP);
+  if (intoperand(J->p, b) && intoperand(J->p, c)) {
+    int slow[2];
+    int nslow = 0;
+    int cc;
+    loadbase(J);
+    loadint(J, b, RCX, slow, &nslow);
+    loadint(J, c, RDX, slow, &nslow);
+    oprr(J, 1, 0x39, RDX, RCX);  /* cmp rcx, rdx */
+    switch (GET_OPCODE(i)) {  /* condition for result != A */
+      case OP_LT: cc = a ? CC_GE : CC_L; break;
+      case OP_LE: cc = a ? CC_G : CC_LE; break;
+      default: cc = a ? CC_NE : CC_E; break;  /* OP_EQ, OP_EQK */
+    }
+    jumppc(J, cc, pc + 2);
+    jumppc(J, -1, pc + 1);
+    while (nslow > 0)
+      patchhere(J, slow[--nslow]);
+  }
+  helper(J, f, pc, f != h_eqk);
+  oprr(J, 0, 0x85, RAX, RAX);  /* test eax, eax */
+  jumppc(J, CC_NE, target);
+  jumppc(J, -1, pc + 2);
+}
+
+
+/*
+** OP_TEST and OP_TESTSET: skip the following jump if the value is false
+** and C is 1, or if it is true and C is 0; otherwise (after the move, for
+** OP_TESTSET) fall into the jump
+*/
+static void test (JitState *J, int pc, Instruction i) {
+  int ra = GETARG_A(i);
+  int rb = (GET_OPCODE(i) == OP_TEST) ? ra : GETARG_B(i);
+  int skipfalse = GETARG_C(i);
+  int fall;
+  loadbase(J);
+  oprm(J, 0, 0x8b, RCX, RBASE, slot(rb) + OFF_TT);  /* mov ecx, tag */
+  oprr(J, 0, 0x85, RCX, RCX);  /* test ecx, ecx (nil is false) */
+  if (skipfalse) jumppc(J, CC_E, pc + 2);
+  else fall = jump(J, CC_E);
+  oprr(J, 0, 0x83, 7, RCX);  /* cmp ecx, LUA_TBOOLEAN */
+  emit8(J, LUA_TBOOLEAN);
+  if (skipfalse) fall = jump(J, CC_NE);  /* other values are true */
+  else jumppc(J, CC_NE, pc + 2);
+  oprm(J, 0, 0x83, 7, RBASE, slot(rb));  /* cmp dword [base + rb], 0 */
+  emit8(J, 0);
+  jumppc(J, skipfalse ? CC_E : CC_NE, pc + 2);
+  patchhere(J, fall);
+  if (ra != rb)  /* OP_TESTSET? */
+    copyvalue(J, RBASE, slot(ra), RBASE, slot(rb));
+}
+
+
+static void forloop (JitState *J, int pc, Instruction i) {
+  int ra = GETARG_A(i);
+  int target = pc + 1 + GETARG_sBx(i);
+  int slow, neg, loop, done1, done2;
+  loadbase(J);
+  cmptag(J, RBASE, slot(ra), LUA_TNUMINT);
+  slow = jump(J, CC_NE);
+  oprm(J, 1, 0x8b, RCX, RBASE, slot(ra));  /* mov rcx, idx */
+  oprm(J, 1, 0x8b, RDX, RBASE, slot(ra + 2));  /* mov rdx, step */
+  oprr(J, 1, 0x01, RDX, RCX);  /* add rcx, rdx */
+  oprr(J, 1, 0x85, RDX, RDX);  /* test rdx, rdx */
+  neg = jump(J, CC_LE);
+  oprm(J, 1, 0x3b, RCX, RBASE, slot(ra + 1));  /* cmp rcx, limit */
+  done1 = jump(J, CC_G);
+  loop = jump(J, -1);
+  patchhere(J, neg);
+  oprm(J, 1, 0x3b, RCX, RBASE, slot(ra + 1));  /* cmp rcx, limit */
+  done2 = jump(J, CC_L);
+  patchhere(J, loop);
+  oprm(J, 1, 0x89, RCX, RBASE, slot(ra));  /* update internal index... */
+  oprm(J, 1, 0x89, RCX, RBASE, slot(ra + 3));  /* ...and external index */
+  settag(J, RBASE, slot(ra + 3), LUA_TNUMINT);
+  jumppc(J, -1, target);
+  patchhere(J, slow);
+  helper(J, h_forloop, pc, 0);
+  oprr(J, 0, 0x85, RAX, RAX);  /* test eax, eax */
+  jumppc(J, CC_NE, target);
+  patchhere(J, done1);
+  patchhere(J, done2);
+}
+
+
+static void compileop (JitState *J, int pc) {
+  Proto *p = J->p;
+  Instruction i = p->code[pc];
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: {
+      loadbase(J);
+      copyvalue(J, RBASE, slot(a), RBASE, slot(GETARG_B(i)));
+      break;
+    }
+    case OP_LOADK: case OP_LOADKX: {
+      int idx = (GET_OPCODE(i) == OP_LOADK) ? GETARG_Bx(i)
+                                            : GETARG_Ax(p->code[pc + 1]);
+      loadbase(J);
+      movimm(J, RCX, cast(size_t, p->k + idx));
+      copyvalue(J, RBASE, slot(a), RCX, 0);
+      break;  /* OP_EXTRAARG has no code */
+    }
+    case OP_LOADBOOL: {
+      loadbase(J);
+      oprm(J, 0, 0xc7, 0, RBASE, slot(a));  /* mov dword [base + a], b */
+      emit32(J, GETARG_B(i));
+      settag(J, RBASE, slot(a), LUA_TBOOLEAN);
+      if (GETARG_C(i))
+        jumppc(J, -1, pc + 2);
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      loadbase(J);
+      do {
+        settag(J, RBASE, slot(a++), LUA_TNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: {
+      loadbase(J);
+      loadupval(J, RCX, GETARG_B(i));
+      copyvalue(J, RBASE, slot(a), RCX, 0);
+      break;
+    }
+    case OP_GETTABUP: case OP_GETUPFIELD: gettab(J, pc, i, h_gettabup); break;
+    case OP_GETTABLE: gettab(J, pc, i, h_gettable); break;
+    case OP_SETTABUP: helper(J, h_settabup, pc, 1); break;
+    case OP_SETUPVAL: helper(J, h_setupval, pc, 0); break;
+    case OP_SETTABLE: helper(J, h_settable, pc, 1); break;
+    case OP_NEWTABLE: helper(J, h_newtable, pc, 1); break;
+    case OP_SELF: case OP_SELFCALL: gettab(J, pc, i, h_self); break;
+    case OP_ADD: case OP_SUB: case OP_MUL:
+    case OP_BAND: case OP_BOR: case OP_BXOR: arith(J, pc, i); break;
+    case OP_MOD: case OP_POW: case OP_DIV: case OP_IDIV:
+    case OP_SHL: case OP_SHR: helper(J, h_arith, pc, 1); break;
+    case OP_UNM: case OP_BNOT: helper(J, h_unary, pc, 1); break;
+    case OP_NOT: helper(J, h_not, pc, 0); break;
+    case OP_LEN: helper(J, h_len, pc, 1); break;
+    case OP_CONCAT: helper(J, h_concat, pc, 1); break;
+    case OP_JMP: {
+      if (a != 0)
+        helper(J, h_jmp, pc, 0);
+      jumppc(J, -1, pc + 1 + GETARG_sBx(i));
+      break;
+    }
+    case OP_EQ: compare(J, pc, i, h_eq); break;
+    case OP_EQK: compare(J, pc, i, h_eqk); break;
+    case OP_LT: compare(J, pc, i, h_lt); break;
+    case OP_LE: compare(J, pc, i, h_le); break;
+    case OP_TEST: case OP_TESTSET: test(J, pc, i); break;
+    case OP_CALL: chain(J, h_call, pc); break;
+    case OP_TAILCALL: chain(J, h_tailcall, pc); break;
+    case OP_RETURN: chain(J, h_return, pc); break;
+    case OP_FORLOOP: forloop(J, pc, i); break;
+    case OP_FORPREP: {
+      helper(J, h_forprep, pc, 0);
+      jumppc(J, -1, pc + 1 + GETARG_sBx(i));
+      break;
+    }
+    case OP_TFORCALL: helper(J, h_tforcall, pc, 1); break;
+    case OP_TFORLOOP: {
+      int done;
+      loadbase(J);
+      cmptag(J, RBASE, slot(a + 1), LUA_TNIL);
+      done = jump(J, CC_E);
+      copyvalue(J, RBASE, slot(a), RBASE, slot(a + 1));
+      jumppc(J, -1, pc + 1 + GETARG_sBx(i));
+      patchhere(J, done);
+      break;
+    }
+    case OP_SETLIST: helper(J, h_setlist, pc, 0); break;
+    case OP_CLOSURE: helper(J, h_closure, pc, 1); break;
+    case OP_VARARG: helper(J, h_vararg, pc, 0); break;
+    case OP_EXTRAARG: break;  /* consumed by the previous instruction */
+  }
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Native code memory and interface
+** =======================================================
+*/
+
+static void *rawrealloc (lua_State *L, void *block, size_t osize,
+                         size_t nsize) {
+  global_State *g = G(L);
+  return (*g->frealloc)(g->ud, block, osize, nsize);
+}
+
+
+/* make room for one more instruction; return 0 if out of memory */
+static int reserve (JitState *J) {
+  size_t need = J->n + MAXFRAGMENT;
+  if (J->size < need) {
+    size_t nsize = J->size * 2 < need ? need : J->size * 2;
+    lu_byte *code = cast(lu_byte *, rawrealloc(J->L, J->code, J->size, nsize));
+    if (code == NULL) return 0;
+    J->code = code;
+    J->size = nsize;
+  }
+  if (J->sizefix - J->nfix < 4) {
+    int nsize = J->sizefix * 2 + 16;
+    JitFix *fix = cast(JitFix *, rawrealloc(J->L, J->fix,
+                           J->sizefix * sizeof(JitFix), nsize * sizeof(JitFix)));
+    if (fix == NULL) return 0;
+    J->fix = fix;
+    J->sizefix = nsize;
+  }
+  return 1;
+}
+
+
+/* copy finished code into executable memory */
+static lu_byte *install (lua_State *L, const lu_byte *code, size_t size) {
+  global_State *g = G(L);
+  JitBlock *b = g->jitblocks;
+  lu_byte *res;
+  size = (size + 15) & ~cast(size_t, 15);
+  if (b == NULL || b->size - b->used < size) {  /* need a new block? */
+    size_t bsize = JITBLOCK;
+    void *mem;
+    while (bsize < size) bsize *= 2;
+    mem = mmap(NULL, bsize, PROT_READ | PROT_EXEC,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+    b = cast(JitBlock *, rawrealloc(L, NULL, 0, sizeof(JitBlock)));
+    if (b == NULL) {
+      munmap(mem, bsize);
+      return NULL;
+    }
+    b->mem = cast(lu_byte *, mem);
+    b->size = bsize;
+    b->used = 0;
+    b->next = g->jitblocks;
+    g->jitblocks = b;
+  }
+  if (mprotect(b->mem, b->size, PROT_READ | PROT_WRITE) != 0)
+    return NULL;
+  res = b->mem + b->used;
+  memcpy(res, code, size);
+  b->used += size;
+  mprotect(b->mem, b->size, PROT_READ | PROT_EXEC);
+  return res;
+}
+
+
+/*
+** Compile prototype 'p'. Only the (small) tables kept with the prototype
+** may raise memory errors; running out of memory for native code just
+** leaves the function with the interpreter.
+*/
+void luaJ_compile (lua_State *L, Proto *p) {
+  JitState J;
+  int pc;
+  int *map;
+  if (p->icache == NULL && p->sizek > 0) {  /* code uses cache addresses */
+    int j;
+    p->icache = luaM_newvector(L, p->sizek, ICache);
+    for (j = 0; j < p->sizek; j++)
+      p->icache[j].t = p->icache[j].mt = NULL;
+  }
+  map = luaM_newvector(L, p->sizecode, int);
+  J.L = L; J.p = p; J.map = map;
+  J.code = NULL; J.size = J.n = 0;
+  J.fix = NULL; J.nfix = J.sizefix = 0;
+  if (reserve(&J)) {
+    prologue(&J);
+    for (pc = 0; pc < p->sizecode; pc++) {
+      if (!reserve(&J)) break;
+      map[pc] = cast_int(J.n);
+      compileop(&J, pc);
+    }
+    if (pc == p->sizecode) {  /* all code generated? */
+      int f;
+      for (f = 0; f < J.nfix; f++)
+        patchto(&J, J.fix[f].pos, map[J.fix[f].pc]);
+      p->jitcode = install(L, J.code, J.n);
+    }
+  }
+  rawrealloc(L, J.code, J.size, 0);
+  rawrealloc(L, J.fix, J.sizefix * sizeof(JitFix), 0);
+  if (p->jitcode != NULL)
+    p->jitmap = map;
+  else
+    luaM_freearray(L, map, p->sizecode);
+}
+
+
+/*
+** Run the native code of the function of 'ci' from its 'savedpc' until
+** it leaves native code, maybe in another frame ('L->ci'); return one
+** of the JIT_* results.
+*/
+int luaJ_execute (lua_State *L, CallInfo *ci) {
+  Proto *p = clLvalue(ci->func)->p;
+  JitFunction f = cast(JitFunction, p->jitcode);
+  return (*f)(L, ci, p->jitcode + p->jitmap[ci->u.l.savedpc - p->code]);
+}
+
+
+void luaJ_close (lua_State *L) {
+  global_State *g = G(L);
+  JitBlock *b = g->jitblocks;
+  while (b != NULL) {
+    JitBlock *next = b->next;
+    munmap(b->mem, b->size);
+    rawrealloc(L, b, sizeof(JitBlock), 0);
+    b = next;
+  }
+  g->jitblocks = NULL;
+}
+
+/* }====================================================== */
+
+#endif
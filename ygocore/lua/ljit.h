@@ -0,0 +1,58 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler from Lua bytecode to native x86-64 code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+#if defined(LUA_USE_JIT)
+
+#if !defined(__x86_64__) || defined(_WIN32)
+#error "LUA_USE_JIT needs an x86-64 target with the System V calling convention"
+#endif
+
+#if defined(__cplusplus) && !defined(LUA_USE_LONGJMP)
+#error "LUA_USE_JIT needs LUA_USE_LONGJMP (native code has no unwind tables)"
+#endif
+
+
+/* number of calls after which a Lua function is compiled */
+#if !defined(LUAI_HOTCALLS)
+#define LUAI_HOTCALLS	50
+#endif
+
+
+/* count a call to prototype 'p', compiling it when it gets hot */
+#define luaJ_count(L,p) \
+	{ if ((p)->ncalls < LUAI_HOTCALLS && ++(p)->ncalls == LUAI_HOTCALLS) \
+	    luaJ_compile(L, p); }
+
+/* memory used by the compiler for prototype 'p' (besides native code) */
+#define luaJ_size(p)	((p)->jitmap ? sizeof(int) * (p)->sizecode : 0)
+
+
+/* results of 'luaJ_execute' */
+#define JIT_DEOPT	0	/* continue 'L->ci' in the interpreter */
+#define JIT_NEWFRAME	1	/* (re)start 'L->ci' at its 'savedpc' */
+#define JIT_RETURN	2	/* the fresh frame returned */
+
+
+LUAI_FUNC void luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC int luaJ_execute (lua_State *L, CallInfo *ci);
+LUAI_FUNC void luaJ_close (lua_State *L);
+
+#else
+
+#define luaJ_count(L,p)	((void)0)
+#define luaJ_size(p)	0
+#define luaJ_close(L)	((void)0)
+
+#endif
+
+#endif
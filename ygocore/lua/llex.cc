@@ -67,6 +67,132 @@ static void save (LexState *ls, int c) {
 }
 
 
+/*
+** {======================================================
+** Fast scanning
+** Runs of characters that need no per-character work (names, blanks,
+** comments, long strings) are found directly in the block of the
+** input already read by 'ls->z', a whole SSE2 vector at a time when
+** available, and saved with a single copy.
+** =======================================================
+*/
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+#define LEX_SSE2
+
+/* index of the lowest bit set in 'm' (which is not 0) */
+#if defined(__GNUC__)
+#define firstbit(m)	__builtin_ctz(m)
+#else
+static int firstbit (unsigned int m) {
+  int i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+#define loadvec(p)	_mm_loadu_si128(cast(const __m128i *, p))
+#define vecmask(v)	cast(unsigned int, _mm_movemask_epi8(v))
+#define veceq(v,c)	_mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define vecin(v,l,h)	_mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((l) - 1)), \
+			              _mm_cmplt_epi8(v, _mm_set1_epi8((h) + 1)))
+
+#endif
+
+
+/* first character in [p, e) that cannot continue a name */
+static const char *skipname (const char *p, const char *e) {
+#if defined(LEX_SSE2)
+  for (; e - p >= 16; p += 16) {
+    __m128i v = loadvec(p);
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8('a' - 'A'));
+    unsigned int m = vecmask(_mm_or_si128(
+                       _mm_or_si128(vecin(lower, 'a', 'z'), vecin(v, '0', '9')),
+                       veceq(v, '_')));
+    if (m != 0xFFFF)
+      return p + firstbit(~m);
+  }
+#endif
+  while (p < e && lislalnum(cast_uchar(*p))) p++;
+  return p;
+}
+
+
+/* first character in [p, e) that is not a blank (other than newlines) */
+static const char *skipblanks (const char *p, const char *e) {
+#if defined(LEX_SSE2)
+  for (; e - p >= 16; p += 16) {
+    __m128i v = loadvec(p);
+    unsigned int m = vecmask(_mm_or_si128(
+                       _mm_or_si128(veceq(v, ' '), veceq(v, '\t')),
+                       _mm_or_si128(veceq(v, '\f'), veceq(v, '\v'))));
+    if (m != 0xFFFF)
+      return p + firstbit(~m);
+  }
+#endif
+  while (p < e && (*p == ' ' || *p == '\t' || *p == '\f' || *p == '\v')) p++;
+  return p;
+}
+
+
+/* first character in [p, e) that is a newline or 'c' */
+static const char *findnewline (const char *p, const char *e, char c) {
+#if defined(LEX_SSE2)
+  for (; e - p >= 16; p += 16) {
+    __m128i v = loadvec(p);
+    unsigned int m = vecmask(_mm_or_si128(
+                       _mm_or_si128(veceq(v, '\n'), veceq(v, '\r')),
+                       veceq(v, c)));
+    if (m != 0)
+      return p + firstbit(m);
+  }
+#endif
+  while (p < e && *p != '\n' && *p != '\r' && *p != c) p++;
+  return p;
+}
+
+
+/* save the 'l' characters at 's' */
+static void savespan (LexState *ls, const char *s, size_t l) {
+  Mbuffer *b = ls->buff;
+  if (l == 0) return;  /* 's' may be NULL (empty block) */
+  if (l > luaZ_sizebuffer(b) - luaZ_bufflen(b)) {
+    size_t newsize = luaZ_sizebuffer(b);
+    do {
+      if (newsize >= MAX_SIZE/2)
+        lexerror(ls, "lexical element too long", 0);
+      newsize *= 2;
+    } while (l > newsize - luaZ_bufflen(b));
+    luaZ_resizebuffer(ls->L, b, newsize);
+  }
+  memcpy(b->buffer + luaZ_bufflen(b), s, l);
+  luaZ_bufflen(b) += l;
+}
+
+
+/*
+** skip the characters of the current block before 'e' (the current
+** one was already handled) and make the next one current
+*/
+static void skipto (LexState *ls, const char *e) {
+  ZIO *z = ls->z;
+  lua_assert(z->p <= e && e <= z->p + z->n);
+  z->n -= e - z->p;
+  z->p = e;
+  next(ls);
+}
+
+
+/* end of the current block */
+#define blockend(ls)	((ls)->z->p + (ls)->z->n)
+
+/* }====================================================== */
+
+
 void luaX_init (lua_State *L) {
   int i;
   TString *e = luaS_newliteral(L, LUA_ENV);  /* create env name */
@@ -171,6 +297,9 @@ void luaX_setinput (lua_State *L, LexState *ls, ZIO *z, TString *source,
   ls->lastline = 1;
   ls->source = source;
   ls->envn = luaS_newliteral(L, LUA_ENV);  /* get env name */
+  ls->frozen = ls->thaw = NULL;
+  ls->thawed = 0;
+  ls->target = 0;
   luaZ_resizebuffer(ls->L, ls->buff, LUA_MINBUFFER);  /* initialize buffer */
 }
 
@@ -288,9 +417,13 @@ static void read_long_string (LexState *ls, SemInfo *seminfo, int sep) {
         if (!seminfo) luaZ_resetbuffer(ls->buff);  /* avoid wasting space */
         break;
       }
-      default: {
-        if (seminfo) save_and_next(ls);
-        else next(ls);
+      default: {  /* skip (or save) up to the next ']' or newline */
+        const char *e = findnewline(ls->z->p, blockend(ls), ']');
+        if (seminfo) {
+          save(ls, ls->current);
+          savespan(ls, ls->z->p, e - ls->z->p);
+        }
+        skipto(ls, e);
       }
     }
   } endloop:
@@ -435,7 +568,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         break;
       }
       case ' ': case '\f': case '\t': case '\v': {  /* spaces */
-        next(ls);
+        skipto(ls, skipblanks(ls->z->p, blockend(ls)));
         break;
       }
       case '-': {  /* '-' or '--' (comment) */
@@ -453,8 +586,8 @@ static int llex (LexState *ls, SemInfo *seminfo) {
           }
         }
         /* else short comment */
-        while (!currIsNewline(ls) && ls->current != EOZ)
-          next(ls);  /* skip until end of line (or end of file) */
+        while (!currIsNewline(ls) && ls->current != EOZ)  /* skip until */
+          skipto(ls, findnewline(ls->z->p, blockend(ls), '\n'));  /* EOL */
         break;
       }
       case '[': {  /* long string or simply '[' */
@@ -523,8 +656,11 @@ static int llex (LexState *ls, SemInfo *seminfo) {
       default: {
         if (lislalpha(ls->current)) {  /* identifier or reserved word? */
           TString *ts;
-          do {
-            save_and_next(ls);
+          do {  /* a name may continue in the next block */
+            const char *e = skipname(ls->z->p, blockend(ls));
+            save(ls, ls->current);
+            savespan(ls, ls->z->p, e - ls->z->p);
+            skipto(ls, e);
           } while (lislalnum(ls->current));
           ts = luaX_newstring(ls, luaZ_buffer(ls->buff),
                                   luaZ_bufflen(ls->buff));
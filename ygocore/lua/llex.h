@@ -69,6 +69,10 @@ typedef struct LexState {
   struct Dyndata *dyd;  /* dynamic structures used by the parser */
   TString *source;  /* current source name */
   TString *envn;  /* environment variable name */
+  Table *frozen;  /* frozen constants, or NULL (see 'luaY_parser') */
+  Table *thaw;  /* names the chunk thaws, removed from 'frozen' at its end */
+  lu_byte thawed;  /* chunk assigns to frozen names (THAW*) */
+  lu_byte target;  /* next global name may be assigned to */
 } LexState;
 
 
@@ -71,6 +71,19 @@ l_noret luaM_toobig (lua_State *L) {
 
 
 
+/*
+** Would growing a block from 'os' to 'ns' bytes take the state over its
+** memory limit? Only allocations under a protected call (or in a
+** coroutine) are limited: an error anywhere else would make the state
+** panic. (A thread without a handler of its own throws to the main one.)
+*/
+#define overlimit(L,g,os,ns)  \
+	((g)->memlimit != 0 && (ns) > (os) && \
+	 ((L)->nprotected > 0 || \
+	  ((L)->errorJmp == NULL && (g)->mainthread->nprotected > 0)) && \
+	 gettotalbytes(g) - (os) + (ns) > (g)->memlimit)
+
+
 /*
 ** generic allocation routine.
 */
@@ -83,12 +96,18 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   if (nsize > realosize && g->gcrunning)
     luaC_fullgc(L, 1);  /* force a GC whenever possible */
 #endif
-  newblock = (*g->frealloc)(g->ud, block, osize, nsize);
+  if (overlimit(L, g, realosize, nsize))
+    newblock = NULL;
+  else
+    newblock = (*g->frealloc)(g->ud, block, osize, nsize);
   if (newblock == NULL && nsize > 0) {
     lua_assert(nsize > realosize);  /* cannot fail when shrinking a block */
     if (g->version) {  /* is state fully built? */
       luaC_fullgc(L, 1);  /* try to free some memory... */
-      newblock = (*g->frealloc)(g->ud, block, osize, nsize);  /* try again */
+      if (overlimit(L, g, realosize, nsize))
+        g->memexceeded = 1;
+      else
+        newblock = (*g->frealloc)(g->ud, block, osize, nsize);  /* try again */
     }
     if (newblock == NULL)
       luaD_throw(L, LUA_ERRMEM);
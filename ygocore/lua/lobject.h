@@ -401,6 +401,23 @@ typedef struct LocVar {
 } LocVar;
 
 
+/*
+** Inline cache for lookups with a constant short-string key. 'slot' is
+** the entry of the key in table 't', valid while 't->stamp' equals
+** 'stamp'. When the key was found through the '__index' table of a
+** userdata metatable, 'mt' is that metatable and 'mtslot' its
+** '__index' entry; otherwise 'mt' is NULL.
+*/
+typedef struct ICache {
+  const struct Table *t;
+  const TValue *slot;
+  lu_mem stamp;
+  const struct Table *mt;
+  const TValue *mtslot;
+  lu_mem mtstamp;
+} ICache;
+
+
 /*
 ** Function Prototypes
 */
@@ -409,6 +426,7 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed parameters */
   lu_byte is_vararg;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte stripped;  /* debug information dropped (see 'luaG_loaddebug') */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -424,6 +442,12 @@ typedef struct Proto {
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   struct LClosure *cache;  /* last-created closure with this prototype */
+  ICache *icache;  /* inline caches, one per constant (created on demand) */
+#if defined(LUA_USE_JIT)
+  lu_byte *jitcode;  /* native code of the function (see 'luaJ_compile') */
+  int *jitmap;  /* offset in 'jitcode' of the code of each instruction */
+  int ncalls;  /* number of calls (counted up to LUAI_HOTCALLS) */
+#endif
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -501,9 +525,11 @@ typedef struct Table {
   unsigned int sizearray;  /* size of 'array' array */
   TValue *array;  /* array part */
   Node *node;
-  Node *lastfree;  /* any free position is before this position */
+  Node *lastfree;  /* any free position is before this position (with
+                      LUA_USE_SWISSTABLE, node + number of free positions) */
   struct Table *metatable;
   GCObject *gclist;
+  lu_mem stamp;  /* changes whenever hash entries move (see 'ICache') */
 } Table;
 
 
@@ -230,11 +230,21 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* superinstructions (see notes below) */
+OP_GETUPFIELD,/* A B C	as OP_GETTABUP; next instruction is OP_GETTABLE	*/
+OP_SELFCALL,/*	A B C	as OP_SELF; next instruction is OP_CALL		*/
+OP_EQK/*	A B C	as OP_EQ, with B or C a constant		*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_EQK) + 1)
+
+/* regular opcode that a superinstruction stands for */
+#define basicop(o)  ((o) == OP_GETUPFIELD ? OP_GETTABUP : \
+                     (o) == OP_SELFCALL ? OP_SELF : \
+                     (o) == OP_EQK ? OP_EQ : (o))
 
 
 
@@ -259,6 +269,12 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
   (*) All 'skips' (pc++) assume that next instruction is a jump.
 
+  (*) Superinstructions are never generated by the code generator;
+  'luaK_fuse' puts them in finished (or loaded) functions, and dumps
+  have them replaced by their 'basicop'. Each one does the work of its
+  basic opcode and then goes straight to the following instruction,
+  which is left unchanged (so jumps to it still work).
+
 ===========================================================================*/
 
 
@@ -292,12 +292,77 @@ static void singlevaraux (FuncState *fs, TString *n, expdesc *var, int base) {
 }
 
 
+/*
+** Frozen constants. While the registry field LUA_FROZENTABLE holds a
+** table, a global name read through the chunk's own '_ENV' that has a
+** number in that table is compiled as that number, so it costs a LOADK
+** (or nothing, inside a constant expression) instead of a table access.
+** A chunk that assigns to such a name 'thaws' it: the name is kept in
+** table 'thaw' and the whole chunk is parsed again, without inlining
+** it. Once the chunk compiles, thawed names are removed from the frozen
+** table; a chunk with a syntax error thaws nothing.
+*/
+
+/* values for 'thawed' */
+#define THAWNAME	1	/* some frozen names were thawed */
+#define THAWALL		2	/* chunk assigns to '_ENV' itself */
+
+
+/* frozen value for global 'varname' (NULL if none) */
+static const TValue *frozenvar (LexState *ls, TString *varname) {
+  FuncState *fs;
+  const TValue *o;
+  if (ls->frozen == NULL || varname->tt != LUA_TSHRSTR)
+    return NULL;
+  o = luaH_getshortstr(ls->frozen, varname);
+  if (!ttisnumber(o) || !ttisnil(luaH_getshortstr(ls->thaw, varname)))
+    return NULL;  /* not frozen, or thawed by this chunk */
+  for (fs = ls->fs; fs != NULL; fs = fs->prev) {
+    if (searchvar(fs, ls->envn) >= 0)
+      return NULL;  /* a local '_ENV' is in scope */
+  }
+  return o;
+}
+
+
+/* check an assignment target against the frozen constants */
+static void checkthaw (LexState *ls, expdesc *v) {
+  FuncState *fs = ls->fs;
+  if (ls->frozen == NULL)
+    return;
+  if (v->k == VUPVAL && eqstr(fs->f->upvalues[v->u.info].name, ls->envn))
+    ls->thawed = THAWALL;
+  else if (v->k == VINDEXED && v->u.ind.vt == VUPVAL && ISK(v->u.ind.idx) &&
+           eqstr(fs->f->upvalues[v->u.ind.t].name, ls->envn)) {
+    TValue *key = &fs->f->k[INDEXK(v->u.ind.idx)];
+    if (ttisshrstring(key) && frozenvar(ls, tsvalue(key)) != NULL) {
+      setbvalue(luaH_set(ls->L, ls->thaw, key), 1);
+      if (!ls->thawed) ls->thawed = THAWNAME;
+    }
+  }
+}
+
+
 static void singlevar (LexState *ls, expdesc *var) {
   TString *varname = str_checkname(ls);
   FuncState *fs = ls->fs;
+  int target = ls->target;
+  ls->target = 0;
   singlevaraux(fs, varname, var, 1);
   if (var->k == VVOID) {  /* global name? */
     expdesc key;
+    const TValue *o = target ? NULL : frozenvar(ls, varname);
+    if (o != NULL) {  /* frozen constant? */
+      if (ttisinteger(o)) {
+        init_exp(var, VKINT, 0);
+        var->u.ival = ivalue(o);
+      }
+      else {
+        init_exp(var, VKFLT, 0);
+        var->u.nval = fltvalue(o);
+      }
+      return;
+    }
     singlevaraux(fs, ls->envn, var, 1);  /* get environment variable */
     lua_assert(var->k != VVOID);  /* this one must exist */
     codestring(ls, &key, varname);  /* key is variable name */
@@ -557,6 +622,7 @@ static void close_func (LexState *ls) {
   leaveblock(fs);
   luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
   f->sizecode = fs->pc;
+  luaK_fuse(f);
   luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
   f->sizelineinfo = fs->pc;
   luaM_reallocvector(L, f->k, f->sizek, fs->nk, TValue);
@@ -1147,10 +1213,13 @@ static void check_conflict (LexState *ls, struct LHS_assign *lh, expdesc *v) {
 static void assignment (LexState *ls, struct LHS_assign *lh, int nvars) {
   expdesc e;
   check_condition(ls, vkisvar(lh->v.k), "syntax error");
+  checkthaw(ls, &lh->v);
   if (testnext(ls, ',')) {  /* assignment -> ',' suffixedexp assignment */
     struct LHS_assign nv;
     nv.prev = lh;
+    ls->target = 1;
     suffixedexp(ls, &nv.v);
+    ls->target = 0;
     if (nv.v.k != VINDEXED)
       check_conflict(ls, lh, &nv.v);
     checklimit(ls->fs, nvars + ls->L->nCcalls, LUAI_MAXCCALLS,
@@ -1462,6 +1531,7 @@ static void localstat (LexState *ls) {
 static int funcname (LexState *ls, expdesc *v) {
   /* funcname -> NAME {fieldsel} [':' NAME] */
   int ismethod = 0;
+  ls->target = 1;  /* may be assigned to */
   singlevar(ls, v);
   while (ls->t.token == '.')
     fieldsel(ls, v);
@@ -1479,6 +1549,7 @@ static void funcstat (LexState *ls, int line) {
   expdesc v, b;
   luaX_next(ls);  /* skip FUNCTION */
   ismethod = funcname(ls, &v);
+  checkthaw(ls, &v);
   body(ls, &b, ismethod, line);
   luaK_storevar(ls->fs, &v, &b);
   luaK_fixline(ls->fs, line);  /* definition "happens" in the first line */
@@ -1489,7 +1560,9 @@ static void exprstat (LexState *ls) {
   /* stat -> func | assignment */
   FuncState *fs = ls->fs;
   struct LHS_assign v;
+  ls->target = 1;  /* may be an assignment */
   suffixedexp(ls, &v.v);
+  ls->target = 0;
   if (ls->t.token == '=' || ls->t.token == ',') { /* stat -> assignment ? */
     v.prev = NULL;
     assignment(ls, &v, 1);
@@ -1623,28 +1696,122 @@ static void mainfunc (LexState *ls, FuncState *fs) {
 }
 
 
+/*
+** A chunk compiled with frozen constants may have to be parsed again
+** (see 'checkthaw'), so its text is kept in table 'blocks' as it is
+** read: 'replayreader' gives back the blocks already kept and then asks
+** the original reader for more.
+*/
+typedef struct Replay {
+  lua_Reader reader;  /* original reader (NULL after its end) */
+  void *data;
+  Table *blocks;  /* text read so far */
+  int n;  /* number of blocks */
+  int next;  /* next block to give */
+} Replay;
+
+
+static void addblock (lua_State *L, Replay *rp, const char *b, size_t size) {
+  setsvalue2s(L, L->top, luaS_newlstr(L, b, size));  /* anchor it */
+  luaD_inctop(L);
+  luaH_setint(L, rp->blocks, ++rp->n, L->top - 1);
+  luaC_barrierback(L, rp->blocks, L->top - 1);
+  L->top--;
+}
+
+
+static const char *replayreader (lua_State *L, void *ud, size_t *size) {
+  Replay *rp = cast(Replay *, ud);
+  const char *b;
+  if (rp->next <= rp->n) {  /* block already kept? */
+    TString *ts = tsvalue(luaH_getint(rp->blocks, rp->next));
+    rp->next++;
+    *size = tsslen(ts);
+    return getstr(ts);
+  }
+  if (rp->reader == NULL)
+    return NULL;
+  b = rp->reader(L, rp->data, size);
+  if (b == NULL || *size == 0)
+    rp->reader = NULL;  /* end of chunk */
+  else {
+    addblock(L, rp, b, *size);
+    rp->next++;
+  }
+  return b;
+}
+
+
+/* remove the names thawed by a chunk that compiled from 'frozen' */
+static void thawnames (lua_State *L, Table *frozen, Table *thaw) {
+  luaD_checkstack(L, 2);  /* room for a key and its value */
+  setnilvalue(L->top);  /* first key */
+  while (luaH_next(L, thaw, L->top))
+    setnilvalue(luaH_set(L, frozen, L->top));
+}
+
+
 LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
                        Dyndata *dyd, const char *name, int firstchar) {
   LexState lexstate;
   FuncState funcstate;
-  LClosure *cl = luaF_newLclosure(L, 1);  /* create main closure */
+  LClosure *cl;
+  Replay rp;
+  ZIO rz;
+  Table *thaw = NULL;
+  int thawall = 0;
+  const TValue *o = luaH_getshortstr(hvalue(&G(L)->l_registry),
+                                     luaS_newliteral(L, LUA_FROZENTABLE));
+  Table *frozen = ttistable(o) ? hvalue(o) : NULL;
+  if (frozen != NULL) {  /* keep the text, to parse it again if needed */
+    rp.blocks = luaH_new(L);
+    sethvalue(L, L->top, rp.blocks);  /* anchor it */
+    luaD_inctop(L);
+    thaw = luaH_new(L);
+    sethvalue(L, L->top, thaw);  /* anchor it */
+    luaD_inctop(L);
+    rp.n = 0;
+    rp.next = 1;
+    if (z->n > 0)  /* rest of the first block */
+      addblock(L, &rp, z->p, z->n);
+    rp.reader = z->reader;
+    rp.data = z->data;
+    luaZ_init(L, &rz, replayreader, &rp);
+    z = &rz;
+  }
+  cl = luaF_newLclosure(L, 1);  /* create main closure */
   setclLvalue(L, L->top, cl);  /* anchor it (to avoid being collected) */
   luaD_inctop(L);
   lexstate.h = luaH_new(L);  /* create table for scanner */
   sethvalue(L, L->top, lexstate.h);  /* anchor it */
   luaD_inctop(L);
-  funcstate.f = cl->p = luaF_newproto(L);
-  funcstate.f->source = luaS_new(L, name);  /* create and anchor TString */
-  lua_assert(iswhite(funcstate.f));  /* do not need barrier here */
   lexstate.buff = buff;
   lexstate.dyd = dyd;
-  dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
-  luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
-  mainfunc(&lexstate, &funcstate);
-  lua_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
-  /* all scopes should be correctly finished */
-  lua_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0);
+  for (;;) {
+    funcstate.f = cl->p = luaF_newproto(L);
+    luaC_objbarrier(L, cl, cl->p);  /* 'cl' may be old when parsing again */
+    funcstate.f->source = luaS_new(L, name);  /* create and anchor TString */
+    lua_assert(iswhite(funcstate.f));  /* do not need barrier here */
+    dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
+    luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
+    lexstate.frozen = thawall ? NULL : frozen;
+    lexstate.thaw = thaw;
+    mainfunc(&lexstate, &funcstate);
+    lua_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
+    /* all scopes should be correctly finished */
+    lua_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0);
+    if (!lexstate.thawed)
+      break;
+    if (lexstate.thawed == THAWALL)
+      thawall = 1;  /* '_ENV' changes: no frozen constants at all */
+    rp.next = 1;  /* parse the kept text again */
+    luaZ_init(L, &rz, replayreader, &rp);
+  }
   L->top--;  /* remove scanner's table */
+  if (z == &rz) {  /* remove the kept text and 'thaw' from below the closure */
+    thawnames(L, frozen, thaw);
+    setobjs2s(L, L->top - 3, L->top - 1);
+    L->top -= 2;
+  }
   return cl;  /* closure is on the stack, too */
 }
-
@@ -20,6 +20,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "llex.h"
 #include "lmem.h"
 #include "lstate.h"
@@ -36,6 +37,26 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 #endif
 
+#if !defined(LUAI_GENMINORMUL)
+#define LUAI_GENMINORMUL	20  /* minor collection after heap grows 20% */
+#endif
+
+#if !defined(LUAI_GENMAJORMUL)
+#define LUAI_GENMAJORMUL	100  /* major collection after heap doubles */
+#endif
+
+/*
+** maximum number of dead threads kept for reuse by 'lua_newthread', and
+** largest stack (in slots) of a thread that is kept
+*/
+#if !defined(LUAI_MAXPOOL)
+#define LUAI_MAXPOOL	16
+#endif
+
+#if !defined(LUAI_POOLSTACK)
+#define LUAI_POOLSTACK	1024
+#endif
+
 
 /*
 ** a macro to help the creation of a unique random seed when a state is
@@ -234,6 +255,7 @@ static void preinit_thread (lua_State *L, global_State *g) {
   resethookcount(L);
   L->openupval = NULL;
   L->nny = 1;
+  L->nprotected = 0;
   L->status = LUA_OK;
   L->errfunc = 0;
 }
@@ -242,9 +264,17 @@ static void preinit_thread (lua_State *L, global_State *g) {
 static void close_state (lua_State *L) {
   global_State *g = G(L);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
-  luaC_freeallobjects(L);  /* collect all objects */
+  if (g->release == NULL)
+    luaC_freeallobjects(L);  /* collect all objects */
+  else
+    luaC_callallfinalizers(L);  /* objects go away with the whole heap */
+  luaJ_close(L);  /* release native code */
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
+  if (g->release != NULL) {
+    (*g->release)(g->ud);  /* free all memory, main block included */
+    return;
+  }
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
@@ -252,13 +282,21 @@ static void close_state (lua_State *L) {
 }
 
 
-LUA_API lua_State *lua_newthread (lua_State *L) {
+/*
+** Creates a thread (or reuses a dead one) and anchors it on the stack of
+** 'L', which must have room for it.
+*/
+lua_State *luaE_newthread (lua_State *L) {
   global_State *g = G(L);
   lua_State *L1;
-  lua_lock(L);
-  luaC_checkGC(L);
-  /* create new thread */
-  L1 = &cast(LX *, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
+  int reused = (g->threadpool != NULL);
+  if (reused) {  /* reuse a dead thread */
+    L1 = gco2th(g->threadpool);
+    g->threadpool = L1->next;
+    g->npooled--;
+  }
+  else  /* create new thread */
+    L1 = &cast(LX *, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
   L1->marked = luaC_white(g);
   L1->tt = LUA_TTHREAD;
   /* link it on list 'allgc' */
@@ -266,8 +304,9 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   g->allgc = obj2gco(L1);
   /* anchor it on L stack */
   setthvalue(L, L->top, L1);
-  api_incr_top(L);
-  preinit_thread(L1, g);
+  L->top++;
+  if (!reused)
+    preinit_thread(L1, g);
   L1->hookmask = L->hookmask;
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
@@ -276,13 +315,67 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
          LUA_EXTRASPACE);
   luai_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack */
+  if (!reused)
+    stack_init(L1, L);  /* init stack */
+  return L1;
+}
+
+
+LUA_API lua_State *lua_newthread (lua_State *L) {
+  lua_State *L1;
+  lua_lock(L);
+  luaC_checkGC(L);
+  L1 = luaE_newthread(L);
+  api_check(L, L->top <= L->ci->top, "stack overflow");
   lua_unlock(L);
   return L1;
 }
 
 
-void luaE_freethread (lua_State *L, lua_State *L1) {
+/*
+** Resets a thread that is not running (dead, finished or suspended) to
+** the state of a new one, closing its upvalues but keeping its stack and
+** 'ci' list, so that it can be reused without allocating. Returns the
+** error status of a dead thread, LUA_OK otherwise.
+*/
+static int resetthread (lua_State *L) {
+  CallInfo *ci = &L->base_ci;
+  StkId o;
+  int status = L->status;
+  if (status == LUA_YIELD)
+    status = LUA_OK;
+  luaF_close(L, L->stack);  /* close all upvalues for this thread */
+  lua_assert(L->openupval == NULL);
+  for (o = L->stack; o < L->stack + L->stacksize; o++)
+    setnilvalue(o);  /* drop references to old values */
+  L->ci = ci;
+  ci->callstatus = 0;
+  ci->func = L->stack;  /* 'function' entry for this 'ci' */
+  L->top = L->stack + 1;
+  ci->top = L->top + LUA_MINSTACK;
+  L->status = LUA_OK;
+  L->errorJmp = NULL;
+  L->errfunc = 0;
+  L->nCcalls = 0;
+  L->nny = 1;
+  L->nprotected = 0;
+  L->allowhook = 1;  /* an error in a hook may have left it off */
+  return status;
+}
+
+
+LUA_API int lua_resetthread (lua_State *L) {
+  int status;
+  lua_lock(L);
+  api_check(L, L->ci == &L->base_ci || L->status != LUA_OK,
+               "cannot reset running thread");
+  status = resetthread(L);
+  lua_unlock(L);
+  return status;
+}
+
+
+static void freethread (lua_State *L, lua_State *L1) {
   LX *l = fromstate(L1);
   luaF_close(L1, L1->stack);  /* close all upvalues for this thread */
   lua_assert(L1->openupval == NULL);
@@ -292,6 +385,43 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
 }
 
 
+/*
+** Frees a dead thread. Scripts create a thread for every operation that
+** may yield, so up to LUAI_MAXPOOL of them (with small enough stacks)
+** are kept instead, and 'lua_newthread' reuses them with their stack
+** and 'ci' list. An emergency collection frees them all the same.
+*/
+void luaE_freethread (lua_State *L, lua_State *L1) {
+  global_State *g = G(L);
+  if (g->npooled < LUAI_MAXPOOL && g->gckind != KGC_EMERGENCY &&
+      L1->stacksize <= LUAI_POOLSTACK &&
+      (L1->ci == &L1->base_ci || L1->status != LUA_OK)) {
+    resetthread(L1);
+    luai_userstatefree(L, L1);
+    L1->next = g->threadpool;
+    g->threadpool = obj2gco(L1);
+    g->npooled++;
+  }
+  else
+    freethread(L, L1);
+}
+
+
+/*
+** Frees the threads kept for reuse (when the state is closed).
+*/
+void luaE_freethreadpool (lua_State *L) {
+  global_State *g = G(L);
+  while (g->threadpool != NULL) {
+    lua_State *L1 = gco2th(g->threadpool);
+    g->threadpool = L1->next;
+    freestack(L1);  /* upvalues were closed when it was kept */
+    luaM_free(L, fromstate(L1));
+  }
+  g->npooled = 0;
+}
+
+
 LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   int i;
   lua_State *L;
@@ -307,27 +437,42 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   preinit_thread(L, g);
   g->frealloc = f;
   g->ud = ud;
+  g->release = NULL;
+  g->memlimit = 0;
+  g->memexceeded = 0;
   g->mainthread = L;
   g->seed = makeseed(L);
   g->gcrunning = 0;  /* no GC while building state */
   g->GCestimate = 0;
+  g->tablestamp = 0;
+#if defined(LUA_USE_JIT)
+  g->jitblocks = NULL;
+#endif
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
+  g->debugreader = NULL;
+  g->debugud = NULL;
   g->version = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_NORMAL;
+  g->gcmode = KGC_INC;
+  g->gcmajor = g->gcremark = 0;
   g->allgc = g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
+  g->threadpool = NULL;
+  g->npooled = 0;
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->gcminormul = LUAI_GENMINORMUL;
+  g->gcmajormul = LUAI_GENMAJORMUL;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
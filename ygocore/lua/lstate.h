@@ -73,6 +73,11 @@ struct lua_longjmp;  /* defined in ldo.c */
 #define KGC_EMERGENCY	1	/* gc was forced by an allocation failure */
 
 
+/* collector modes */
+#define KGC_INC		0	/* incremental collection */
+#define KGC_GEN		1	/* generational collection */
+
+
 typedef struct stringtable {
   TString **hash;
   int nuse;  /* number of elements */
@@ -137,6 +142,9 @@ typedef struct CallInfo {
 typedef struct global_State {
   lua_Alloc frealloc;  /* function to reallocate memory */
   void *ud;         /* auxiliary data to 'frealloc' */
+  lua_Release release;  /* function to free all memory at once, or NULL */
+  lu_mem memlimit;  /* bytes allocated beyond which allocations fail (or 0) */
+  lu_byte memexceeded;  /* an allocation failed on 'memlimit' */
   l_mem totalbytes;  /* number of bytes currently allocated - GCdebt */
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
   lu_mem GCmemtrav;  /* memory traversed by the GC */
@@ -144,9 +152,13 @@ typedef struct global_State {
   stringtable strt;  /* hash table for strings */
   TValue l_registry;
   unsigned int seed;  /* randomized seed for hashes */
+  lu_mem tablestamp;  /* last stamp given to a table (see 'ICache') */
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
+  lu_byte gcmode;  /* incremental or generational (KGC_INC/KGC_GEN) */
+  lu_byte gcmajor;  /* a major collection is being done in steps */
+  lu_byte gcremark;  /* 'grayagain' moved to 'gray' for the next minor one */
   lu_byte gcrunning;  /* true if GC is running */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
@@ -159,10 +171,19 @@ typedef struct global_State {
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
   struct lua_State *twups;  /* list of threads with open upvalues */
+  GCObject *threadpool;  /* dead threads kept for reuse (see 'luaE_freethread') */
+  lu_byte npooled;  /* number of threads in 'threadpool' */
+#if defined(LUA_USE_JIT)
+  struct JitBlock *jitblocks;  /* memory with native code (see 'ljit.c') */
+#endif
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC 'granularity' */
+  int gcminormul;  /* control for minor generational collections */
+  int gcmajormul;  /* control for major generational collections */
   lua_CFunction panic;  /* to be called in unprotected errors */
+  lua_DebugReader debugreader;  /* to reload dropped debug information */
+  void *debugud;  /* auxiliary data to 'debugreader' */
   struct lua_State *mainthread;
   const lua_Number *version;  /* pointer to version number */
   TString *memerrmsg;  /* memory-error message */
@@ -196,6 +217,7 @@ struct lua_State {
   int basehookcount;
   int hookcount;
   unsigned short nny;  /* number of non-yieldable calls in stack */
+  unsigned short nprotected;  /* number of calls catching errors in stack */
   unsigned short nCcalls;  /* number of nested C calls */
   l_signalT hookmask;
   lu_byte allowhook;
@@ -243,7 +265,9 @@ union GCUnion {
 #define gettotalbytes(g)	cast(lu_mem, (g)->totalbytes + (g)->GCdebt)
 
 LUAI_FUNC void luaE_setdebt (global_State *g, l_mem debt);
+LUAI_FUNC lua_State *luaE_newthread (lua_State *L);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
+LUAI_FUNC void luaE_freethreadpool (lua_State *L);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
 LUAI_FUNC void luaE_freeCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
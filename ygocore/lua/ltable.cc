@@ -21,10 +21,19 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+**
+** With LUA_USE_SWISSTABLE, the hash part uses open addressing instead.
+** Each node has a control byte (kept after the node array) that is
+** either CTRL_EMPTY or 7 bits of the hash of its key; a lookup compares
+** a whole group of control bytes at once and only looks at the nodes
+** whose bytes match. Keys are never removed (as with chains, a removed
+** entry keeps its key with a nil value until the next rehash), so the
+** load factor is kept below 7/8 to keep groups with empty slots.
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -55,6 +64,8 @@
 #define MAXHBITS	(MAXABITS - 1)
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
 #define hashpow2(t,n)		(gnode(t, lmod((n), sizenode(t))))
 
 #define hashstr(t,str)		hashpow2(t, (str)->hash)
@@ -79,6 +90,102 @@ static const Node dummynode_ = {
   {{NILCONSTANT, 0}}  /* key */
 };
 
+#else
+
+#define CTRL_EMPTY	0x80
+
+/*
+** Control bytes are compared a group at a time: 'matchgroup' gives a
+** bit mask of the bytes of a group equal to 'c', 'emptygroup' one of
+** its empty bytes.
+*/
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+#define GROUPSIZE	16
+#define EMPTYGROUP	CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, \
+			CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, \
+			CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, \
+			CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY
+
+static unsigned int matchgroup (const lu_byte *g, int c) {
+  __m128i ctrl = _mm_loadu_si128(cast(const __m128i *, g));
+  __m128i eq = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(cast(char, c)));
+  return cast(unsigned int, _mm_movemask_epi8(eq));
+}
+
+static unsigned int emptygroup (const lu_byte *g) {
+  __m128i ctrl = _mm_loadu_si128(cast(const __m128i *, g));
+  return cast(unsigned int, _mm_movemask_epi8(ctrl));  /* high bits */
+}
+
+#else
+
+#define GROUPSIZE	8
+#define EMPTYGROUP	CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, \
+			CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY
+
+static unsigned int matchgroup (const lu_byte *g, int c) {
+  unsigned int m = 0;
+  int i;
+  for (i = 0; i < GROUPSIZE; i++)
+    m |= cast(unsigned int, g[i] == c) << i;
+  return m;
+}
+
+static unsigned int emptygroup (const lu_byte *g) {
+  return matchgroup(g, CTRL_EMPTY);
+}
+
+#endif
+
+
+/* index of the lowest bit set in 'm' (which is not 0) */
+#if defined(__GNUC__)
+#define firstbit(m)	__builtin_ctz(m)
+#else
+static int firstbit (unsigned int m) {
+  int i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+
+/*
+** Tables smaller than a group still get a whole group of control
+** bytes (the extra ones always empty), so that lookups never need
+** a second group. Larger tables are filled up to 7/8.
+*/
+#define ctrlsize(size)	((size) < GROUPSIZE ? GROUPSIZE : (size))
+#define nodebytes(size)	(sizeof(Node) * (size) + ctrlsize(size))
+#define maxload(size)	((size) < GROUPSIZE ? (size) : (size) - (size) / 8)
+
+/* control bytes of table 't' */
+#define gctrl(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+
+/* 7-bit part of a hash kept in the control byte */
+#define ctrlhash(h)	cast_int((h) & 0x7F)
+
+/* first group probed for hash 'h', and the one after 'g' at probe 'i' */
+#define firstgroup(t,h)	(((h) >> 7) & (sizenode(t) - 1) & ~(GROUPSIZE - 1))
+#define nextgroup(t,g,i)	(((g) + (i) * GROUPSIZE) & (sizenode(t) - 1))
+
+
+#define dummynode		(&dummynode_.node)
+
+static const struct {
+  Node node;
+  lu_byte ctrl[GROUPSIZE];  /* must follow 'node' (see 'gctrl') */
+} dummynode_ = {
+  {{NILCONSTANT}, {{NILCONSTANT, 0}}},
+  {EMPTYGROUP}
+};
+
+#endif
+
 
 /*
 ** Hash for floating-point numbers.
@@ -110,6 +217,8 @@ static int l_hashfloat (lua_Number n) {
 #endif
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
 /*
 ** returns the 'main' position of an element in a table (that is, the index
 ** of its hash value)
@@ -136,6 +245,43 @@ static Node *mainposition (const Table *t, const TValue *key) {
   }
 }
 
+#else
+
+/* spread the bits of a hash over the whole word */
+static unsigned int mixhash (unsigned int h) {
+  h *= 0x9E3779B1u;
+  return h ^ (h >> 16);
+}
+
+
+/*
+** returns the hash of a key (the control byte and first group of its
+** probe sequence come from it)
+*/
+static unsigned int hashkey (const TValue *key) {
+  switch (ttype(key)) {
+    case LUA_TNUMINT:
+      return mixhash(cast(unsigned int, l_castS2U(ivalue(key))));
+    case LUA_TNUMFLT:
+      return mixhash(cast(unsigned int, l_hashfloat(fltvalue(key))));
+    case LUA_TSHRSTR:
+      return mixhash(tsvalue(key)->hash);
+    case LUA_TLNGSTR:
+      return mixhash(luaS_hashlongstr(tsvalue(key)));
+    case LUA_TBOOLEAN:
+      return mixhash(cast(unsigned int, bvalue(key)));
+    case LUA_TLIGHTUSERDATA:
+      return mixhash(point2uint(pvalue(key)));
+    case LUA_TLCF:
+      return mixhash(point2uint(fvalue(key)));
+    default:
+      lua_assert(!ttisdeadkey(key));
+      return mixhash(point2uint(gcvalue(key)));
+  }
+}
+
+#endif
+
 
 /*
 ** returns the index for 'key' if 'key' is an appropriate key to live in
@@ -163,6 +309,7 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
   else {
+#if !defined(LUA_USE_SWISSTABLE)
     int nx;
     Node *n = mainposition(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -179,6 +326,33 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
         luaG_runerror(L, "invalid key to 'next'");  /* key not found */
       else n += nx;
     }
+#else
+    unsigned int h = hashkey(key);
+    const lu_byte *ctrl = gctrl(t);
+    unsigned int g = firstgroup(t, h);
+    unsigned int probe = 0;
+    Node *dead = NULL;
+    for (;;) {  /* check whether 'key' is somewhere in the probed groups */
+      unsigned int m = matchgroup(ctrl + g, ctrlhash(h));
+      for (; m != 0; m &= m - 1) {
+        Node *n = gnode(t, g + firstbit(m));
+        if (luaV_rawequalobj(gkey(n), key))
+          /* hash elements are numbered after array ones */
+          return cast_int(n - gnode(t, 0)) + 1 + t->sizearray;
+        /* key may be dead already, but it is ok to use it in 'next';
+           a live node for a new object at the same address comes later
+           in the probe sequence and must win, or 'next' would cycle */
+        else if (dead == NULL && ttisdeadkey(gkey(n)) &&
+                 iscollectable(key) && deadvalue(gkey(n)) == gcvalue(key))
+          dead = n;
+      }
+      if (emptygroup(ctrl + g) != 0) break;
+      g = nextgroup(t, g, ++probe);
+    }
+    if (dead == NULL)
+      luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    return cast_int(dead - gnode(t, 0)) + 1 + t->sizearray;
+#endif
   }
 }
 
@@ -307,6 +481,8 @@ static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
 }
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
 static void setnodevector (lua_State *L, Table *t, unsigned int size) {
   if (size == 0) {  /* no elements to hash part? */
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
@@ -331,6 +507,53 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
   }
 }
 
+#else
+
+/*
+** In the open-addressing hash part, 'lastfree' counts down the
+** insertions still allowed before a rehash: there are 'lastfree - node'
+** of them.
+*/
+static void setnodevector (lua_State *L, Table *t, unsigned int size) {
+  if (size == 0) {  /* no elements to hash part? */
+    t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
+    t->lsizenode = 0;
+    t->lastfree = NULL;  /* signal that it is using dummy node */
+  }
+  else {
+    int i;
+    int lsize = luaO_ceillog2(size);
+    if (twoto(lsize) >= GROUPSIZE &&
+        size > cast(unsigned int, maxload(twoto(lsize))))
+      lsize++;  /* keep load factor below 7/8 */
+    if (lsize > MAXHBITS)
+      luaG_runerror(L, "table overflow");
+    size = twoto(lsize);
+    if (cast(size_t, size) + 1 > MAX_SIZET / (sizeof(Node) + 1))
+      luaM_toobig(L);
+    t->node = cast(Node *, luaM_malloc(L, nodebytes(size)));
+    for (i = 0; i < (int)size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = 0;  /* not used */
+      setnilvalue(wgkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lsizenode = cast_byte(lsize);
+    memset(gctrl(t), CTRL_EMPTY, ctrlsize(size));
+    t->lastfree = gnode(t, maxload(size));
+  }
+}
+
+#endif
+
+
+/* free the hash part 'node' of a table with 'size' nodes */
+#if !defined(LUA_USE_SWISSTABLE)
+#define freenodes(L,node,size)	luaM_freearray(L, node, cast(size_t, size))
+#else
+#define freenodes(L,node,size)	luaM_freemem(L, node, nodebytes(size))
+#endif
+
 
 typedef struct {
   Table *t;
@@ -380,7 +603,8 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
     }
   }
   if (oldhsize > 0)  /* not the dummy node? */
-    luaM_freearray(L, nold, cast(size_t, oldhsize)); /* free old hash */
+    freenodes(L, nold, oldhsize);  /* free old hash */
+  t->stamp = ++G(L)->tablestamp;  /* all hash entries moved */
 }
 
 
@@ -425,6 +649,7 @@ Table *luaH_new (lua_State *L) {
   t->flags = cast_byte(~0);
   t->array = NULL;
   t->sizearray = 0;
+  t->stamp = ++G(L)->tablestamp;
   setnodevector(L, t, 0);
   return t;
 }
@@ -432,12 +657,14 @@ Table *luaH_new (lua_State *L) {
 
 void luaH_free (lua_State *L, Table *t) {
   if (!isdummy(t))
-    luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
+    freenodes(L, t->node, sizenode(t));
   luaM_freearray(L, t->array, t->sizearray);
   luaM_free(L, t);
 }
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
 static Node *getfreepos (Table *t) {
   if (!isdummy(t)) {
     while (t->lastfree > t->node) {
@@ -493,6 +720,7 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
         gnext(mp) = 0;  /* now 'mp' is free */
       }
       setnilvalue(gval(mp));
+      t->stamp = ++G(L)->tablestamp;  /* an entry moved */
     }
     else {  /* colliding node is in its own main position */
       /* new node will go into free position */
@@ -503,12 +731,58 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
       mp = f;
     }
   }
+  else if (!ttisnil(gkey(mp)))  /* reusing the node of a removed key? */
+    t->stamp = ++G(L)->tablestamp;  /* the node now has another key */
   setnodekey(L, &mp->i_key, key);
   luaC_barrierback(L, t, key);
   lua_assert(ttisnil(gval(mp)));
   return gval(mp);
 }
 
+#else
+
+/*
+** inserts a new key into a hash table, in the first empty node of its
+** probe sequence; nodes are never moved, nor reused before a rehash.
+*/
+TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
+  TValue aux;
+  unsigned int h, m, g, probe = 0;
+  lu_byte *ctrl;
+  Node *n;
+  if (ttisnil(key)) luaG_runerror(L, "table index is nil");
+  else if (ttisfloat(key)) {
+    lua_Integer k;
+    if (luaV_tointeger(key, &k, 0)) {  /* does index fit in an integer? */
+      setivalue(&aux, k);
+      key = &aux;  /* insert it as an integer */
+    }
+    else if (luai_numisnan(fltvalue(key)))
+      luaG_runerror(L, "table index is NaN");
+  }
+  if (isdummy(t) || t->lastfree == t->node) {  /* no more room? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return luaH_set(L, t, key);  /* insert key into grown table */
+  }
+  h = hashkey(key);
+  ctrl = gctrl(t);
+  g = firstgroup(t, h);
+  while ((m = emptygroup(ctrl + g)) == 0)
+    g = nextgroup(t, g, ++probe);
+  g += firstbit(m);
+  lua_assert(cast_int(g) < sizenode(t));
+  ctrl[g] = cast_byte(ctrlhash(h));
+  t->lastfree--;
+  n = gnode(t, g);
+  setnodekey(L, &n->i_key, key);
+  luaC_barrierback(L, t, key);
+  lua_assert(ttisnil(gval(n)));
+  return gval(n);
+}
+
+#endif
+
 
 /*
 ** search function for integers
@@ -518,6 +792,7 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
   if (l_castS2U(key) - 1 < t->sizearray)
     return &t->array[key - 1];
   else {
+#if !defined(LUA_USE_SWISSTABLE)
     Node *n = hashint(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
       if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
@@ -528,6 +803,22 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
         n += nx;
       }
     }
+#else
+    unsigned int h = mixhash(cast(unsigned int, l_castS2U(key)));
+    const lu_byte *ctrl = gctrl(t);
+    unsigned int g = firstgroup(t, h);
+    unsigned int probe = 0;
+    for (;;) {
+      unsigned int m = matchgroup(ctrl + g, ctrlhash(h));
+      for (; m != 0; m &= m - 1) {
+        Node *n = gnode(t, g + firstbit(m));
+        if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
+          return gval(n);  /* that's it */
+      }
+      if (emptygroup(ctrl + g) != 0) break;
+      g = nextgroup(t, g, ++probe);
+    }
+#endif
     return luaO_nilobject;
   }
 }
@@ -536,6 +827,8 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 /*
 ** search function for short strings
 */
+#if !defined(LUA_USE_SWISSTABLE)
+
 const TValue *luaH_getshortstr (Table *t, TString *key) {
   Node *n = hashstr(t, key);
   lua_assert(key->tt == LUA_TSHRSTR);
@@ -571,6 +864,49 @@ static const TValue *getgeneric (Table *t, const TValue *key) {
   }
 }
 
+#else
+
+const TValue *luaH_getshortstr (Table *t, TString *key) {
+  unsigned int h = mixhash(key->hash);
+  const lu_byte *ctrl = gctrl(t);
+  unsigned int g = firstgroup(t, h);
+  unsigned int probe = 0;
+  lua_assert(key->tt == LUA_TSHRSTR);
+  for (;;) {  /* check matching nodes of each probed group */
+    unsigned int m = matchgroup(ctrl + g, ctrlhash(h));
+    for (; m != 0; m &= m - 1) {
+      Node *n = gnode(t, g + firstbit(m));
+      const TValue *k = gkey(n);
+      if (ttisshrstring(k) && eqshrstr(tsvalue(k), key))
+        return gval(n);  /* that's it */
+    }
+    if (emptygroup(ctrl + g) != 0)
+      return luaO_nilobject;  /* not found */
+    g = nextgroup(t, g, ++probe);
+  }
+}
+
+
+static const TValue *getgeneric (Table *t, const TValue *key) {
+  unsigned int h = hashkey(key);
+  const lu_byte *ctrl = gctrl(t);
+  unsigned int g = firstgroup(t, h);
+  unsigned int probe = 0;
+  for (;;) {  /* check matching nodes of each probed group */
+    unsigned int m = matchgroup(ctrl + g, ctrlhash(h));
+    for (; m != 0; m &= m - 1) {
+      Node *n = gnode(t, g + firstbit(m));
+      if (luaV_rawequalobj(gkey(n), key))
+        return gval(n);  /* that's it */
+    }
+    if (emptygroup(ctrl + g) != 0)
+      return luaO_nilobject;  /* not found */
+    g = nextgroup(t, g, ++probe);
+  }
+}
+
+#endif
+
 
 const TValue *luaH_getstr (Table *t, TString *key) {
   if (key->tt == LUA_TSHRSTR)
@@ -680,7 +1016,11 @@ lua_Unsigned luaH_getn (Table *t) {
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
+#if !defined(LUA_USE_SWISSTABLE)
   return mainposition(t, key);
+#else
+  return gnode(t, firstgroup(t, hashkey(key)));
+#endif
 }
 
 int luaH_isdummy (const Table *t) { return isdummy(t); }
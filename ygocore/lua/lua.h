@@ -84,6 +84,9 @@ typedef struct lua_State lua_State;
 #define LUA_RIDX_GLOBALS	2
 #define LUA_RIDX_LAST		LUA_RIDX_GLOBALS
 
+/* registry field with the frozen constants (see 'luaY_parser') */
+#define LUA_FROZENTABLE		"_FROZEN"
+
 
 /* type of numbers in Lua */
 typedef LUA_NUMBER lua_Number;
@@ -123,6 +126,12 @@ typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 */
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
+/*
+** Type for functions that free at once all the memory given by an
+** allocator (see 'lua_setrelease')
+*/
+typedef void (*lua_Release) (void *ud);
+
 
 
 /*
@@ -145,6 +154,7 @@ extern const char lua_ident[];
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
 LUA_API void       (lua_close) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
+LUA_API int        (lua_resetthread) (lua_State *L);
 
 LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
 
@@ -307,7 +317,10 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCSETMAJORINC	8
 #define LUA_GCISRUNNING		9
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
@@ -327,6 +340,10 @@ LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void      (lua_setrelease) (lua_State *L, lua_Release f);
+LUA_API size_t    (lua_getmemlimit) (lua_State *L);
+LUA_API size_t    (lua_setmemlimit) (lua_State *L, size_t limit);
+LUA_API int       (lua_memexceeded) (lua_State *L);
 
 
 
@@ -420,6 +437,13 @@ typedef struct lua_Debug lua_Debug;  /* activation record */
 /* Functions to be called by the debugger in specific events */
 typedef void (*lua_Hook) (lua_State *L, lua_Debug *ar);
 
+/*
+** Function that gives again the chunk named 'source' (as text, or as a
+** binary chunk with debug information), or NULL if it cannot
+*/
+typedef const char * (*lua_DebugReader) (void *ud, const char *source,
+                                         size_t *size);
+
 
 LUA_API int (lua_getstack) (lua_State *L, int level, lua_Debug *ar);
 LUA_API int (lua_getinfo) (lua_State *L, const char *what, lua_Debug *ar);
@@ -437,6 +461,8 @@ LUA_API lua_Hook (lua_gethook) (lua_State *L);
 LUA_API int (lua_gethookmask) (lua_State *L);
 LUA_API int (lua_gethookcount) (lua_State *L);
 
+LUA_API void (lua_setdebugreader) (lua_State *L, lua_DebugReader f, void *ud);
+
 
 struct lua_Debug {
   int event;
@@ -22,6 +22,8 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
+#include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -35,6 +37,23 @@
 #define MAXTAGLOOP	2000
 
 
+/*
+** 'LUA_USE_JUMPTABLE' (defined as 1) selects threaded dispatch in the
+** main interpreter loop: each opcode jumps straight to the next one
+** through a table of label addresses, instead of going back to a single
+** 'switch'. It needs labels as values (gcc and compatible compilers).
+** It showed no gain over the 'switch' on recent x86-64 cores, so it is
+** off by default.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#define LUA_USE_JUMPTABLE	0
+#endif
+
+#if LUA_USE_JUMPTABLE && !defined(__GNUC__)
+#error "LUA_USE_JUMPTABLE needs labels as values (gcc or clang)"
+#endif
+
+
 
 /*
 ** 'l_intfitsf' checks whether a given integer can be converted to a
@@ -650,6 +669,52 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
 }
 
 
+/*
+** put in 'ra' a closure for prototype 'p' created by running closure
+** 'cl' over 'base' (reusing the cached closure when possible)
+*/
+void luaV_closure (lua_State *L, Proto *p, LClosure *cl, StkId base,
+                   StkId ra) {
+  LClosure *ncl = getcached(p, cl->upvals, base);  /* cached closure */
+  if (ncl == NULL)  /* no match? */
+    pushclosure(L, p, cl->upvals, base, ra);  /* create a new one */
+  else
+    setclLvalue(L, ra, ncl);  /* push cashed closure */
+}
+
+
+/*
+** prepare a numeric 'for' loop whose control values start at 'ra':
+** make them all integers or all floats and pre-decrement the index
+*/
+void luaV_forprep (lua_State *L, StkId ra) {
+  TValue *init = ra;
+  TValue *plimit = ra + 1;
+  TValue *pstep = ra + 2;
+  lua_Integer ilimit;
+  int stopnow;
+  if (ttisinteger(init) && ttisinteger(pstep) &&
+      forlimit(plimit, &ilimit, ivalue(pstep), &stopnow)) {
+    /* all values are integer */
+    lua_Integer initv = (stopnow ? 0 : ivalue(init));
+    setivalue(plimit, ilimit);
+    setivalue(init, intop(-, initv, ivalue(pstep)));
+  }
+  else {  /* try making all values floats */
+    lua_Number ninit; lua_Number nlimit; lua_Number nstep;
+    if (!tonumber(plimit, &nlimit))
+      luaG_runerror(L, "'for' limit must be a number");
+    setfltvalue(plimit, nlimit);
+    if (!tonumber(pstep, &nstep))
+      luaG_runerror(L, "'for' step must be a number");
+    setfltvalue(pstep, nstep);
+    if (!tonumber(init, &ninit))
+      luaG_runerror(L, "'for' initial value must be a number");
+    setfltvalue(init, luai_numsub(L, ninit, nstep));
+  }
+}
+
+
 /*
 ** finish execution of an opcode interrupted by an yield
 */
@@ -657,7 +722,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->u.l.base;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = basicop(GET_OPCODE(inst));
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV:
     case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
@@ -752,11 +817,23 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+/*
+** count an instruction for the hooks; only call 'luaG_traceexec' when a
+** hook is due (or for line hooks), so that sampling with a count hook
+** costs little between samples
+*/
+#define traceexec(L)	{ \
+  if ((L->hookmask & LUA_MASKLINE) || L->hookcount == 1) \
+    Protect(luaG_traceexec(L)) \
+  else \
+    L->hookcount--; }
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   i = *(ci->u.l.savedpc++); \
   if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) \
-    Protect(luaG_traceexec(L)); \
+    traceexec(L); \
   ra = RA(i); /* WARNING: any stack reallocation invalidates 'ra' */ \
   lua_assert(base == ci->u.l.base); \
   lua_assert(base <= L->top && L->top < L->stack + L->stacksize); \
@@ -766,6 +843,19 @@ void luaV_finishOp (lua_State *L) {
 #define vmcase(l)	case l:
 #define vmbreak		break
 
+/*
+** end a superinstruction: go straight to the code at label 'lb' for the
+** instruction that follows it (unless hooks must see that instruction;
+** a count hook that is not due only needs it counted)
+*/
+#define vmfuse(lb)	{ \
+  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) { \
+    if ((L->hookmask & LUA_MASKLINE) || L->hookcount == 1) { vmbreak; } \
+    L->hookcount--; } \
+  i = *(ci->u.l.savedpc++); \
+  ra = RA(i); \
+  goto lb; }
+
 
 /*
 ** copy of 'luaV_gettable', but protecting the call to potential
@@ -782,18 +872,118 @@ void luaV_finishOp (lua_State *L) {
     Protect(luaV_finishset(L,t,k,v,slot)); }
 
 
+/*
+** Inline caches. A read 't[k]' where 'k' is a short-string constant
+** goes through the cache entry of that constant (see 'ICache'), so a
+** hit costs a few pointer compares instead of a hash lookup (two for
+** a method called on a userdata). Entries are only filled when the key
+** is found in the table itself or in the '__index' table of a userdata
+** metatable; everything else takes the usual path.
+*/
+
+static const TValue *icmiss (lua_State *L, Proto *p, const TValue *t,
+                             int idx) {
+  TString *key = tsvalue(&p->k[idx]);
+  const TValue *slot;
+  ICache *ic;
+  if (p->icache == NULL) {  /* first miss in this function? */
+    int j;
+    p->icache = luaM_newvector(L, p->sizek, ICache);
+    for (j = 0; j < p->sizek; j++)
+      p->icache[j].t = p->icache[j].mt = NULL;
+  }
+  ic = &p->icache[idx];
+  if (ttistable(t)) {
+    slot = luaH_getshortstr(hvalue(t), key);
+    if (ttisnil(slot))
+      return NULL;
+    ic->t = hvalue(t);
+    ic->mt = NULL;
+  }
+  else if (ttisfulluserdata(t) && uvalue(t)->metatable != NULL) {
+    Table *mt = uvalue(t)->metatable;
+    const TValue *tm = luaH_getshortstr(mt, G(L)->tmname[TM_INDEX]);
+    if (!ttistable(tm))
+      return NULL;
+    slot = luaH_getshortstr(hvalue(tm), key);
+    if (ttisnil(slot))
+      return NULL;
+    ic->t = hvalue(tm);
+    ic->mt = mt;
+    ic->mtslot = tm;
+    ic->mtstamp = mt->stamp;
+  }
+  else return NULL;
+  ic->slot = slot;
+  ic->stamp = ic->t->stamp;
+  return slot;
+}
+
+
+/*
+** Return 't[k]' for the short-string constant 'k' of index 'idx', or
+** NULL if the value is not found without metamethods.
+*/
+const TValue *luaV_icget (lua_State *L, Proto *p, const TValue *t,
+                          int idx) {
+  if (p->icache != NULL) {
+    const ICache *ic = &p->icache[idx];
+    const Table *h = ic->t;
+    if (ttistable(t)) {
+      if (hvalue(t) != h) goto miss;
+    }
+    else if (ttisfulluserdata(t)) {
+      const Table *mt = uvalue(t)->metatable;
+      if (mt == NULL || mt != ic->mt || mt->stamp != ic->mtstamp ||
+          !ttistable(ic->mtslot) || hvalue(ic->mtslot) != h)
+        goto miss;
+    }
+    else goto miss;
+    if (h->stamp == ic->stamp && !ttisnil(ic->slot))
+      return ic->slot;  /* hit */
+  }
+ miss:
+  return icmiss(L, p, t, idx);
+}
+
+
+/* 'gettableProtected' through the inline cache when 'k' allows it */
+#define gettableCached(L,t,k,v)  { const TValue *slot; \
+  if (ISK(GETARG_C(i)) && ttisshrstring(k) && \
+      (slot = luaV_icget(L, cl->p, t, INDEXK(GETARG_C(i)))) != NULL) \
+    { setobj2s(L, v, slot); } \
+  else gettableProtected(L,t,k,v); }
+
+
 
 void luaV_execute (lua_State *L) {
   CallInfo *ci = L->ci;
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
   cl = clLvalue(ci->func);  /* local reference to function's closure */
   k = cl->p->k;  /* local reference to function's constant table */
   base = ci->u.l.base;  /* local copy of function's base */
+#if defined(LUA_USE_JIT)
+  if (cl->p->jitcode != NULL &&
+      !(L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))) {
+    int res = luaJ_execute(L, ci);
+    ci = L->ci;  /* native code may have called or returned */
+    if (res == JIT_RETURN)
+      return;  /* external invocation: return */
+    else if (res == JIT_NEWFRAME)
+      goto newframe;  /* restart luaV_execute over new Lua function */
+    cl = clLvalue(ci->func);  /* continue at 'savedpc' in the interpreter */
+    k = cl->p->k;
+    base = ci->u.l.base;
+  }
+#endif
   /* main loop of interpreter */
   for (;;) {
     Instruction i;
@@ -836,13 +1026,20 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_GETTABUP) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v;
         TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        gettableCached(L, upval, rc, ra);
         vmbreak;
       }
+      vmcase(OP_GETUPFIELD) {
+        TValue *upval = cl->upvals[GETARG_B(i)]->v;
+        TValue *rc = RKC(i);
+        gettableCached(L, upval, rc, ra);
+        vmfuse(l_gettable);
+      }
       vmcase(OP_GETTABLE) {
+        l_gettable:
         StkId rb = RB(i);
         TValue *rc = RKC(i);
-        gettableProtected(L, rb, rc, ra);
+        gettableCached(L, rb, rc, ra);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -874,16 +1071,23 @@ void luaV_execute (lua_State *L) {
         checkGC(L, ra + 1);
         vmbreak;
       }
-      vmcase(OP_SELF) {
+      vmcase(OP_SELF)
+      vmcase(OP_SELFCALL) {
         const TValue *aux;
         StkId rb = RB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
         setobjs2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
+        if (ISK(GETARG_C(i)) && ttisshrstring(rc) &&
+            (aux = luaV_icget(L, cl->p, rb, INDEXK(GETARG_C(i)))) != NULL) {
+          setobj2s(L, ra, aux);
+        }
+        else if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
           setobj2s(L, ra, aux);
         }
         else Protect(luaV_finishget(L, rb, rc, ra, aux));
+        if (GET_OPCODE(i) == OP_SELFCALL)
+          vmfuse(l_call);
         vmbreak;
       }
       vmcase(OP_ADD) {
@@ -1092,6 +1296,22 @@ void luaV_execute (lua_State *L) {
         )
         vmbreak;
       }
+      vmcase(OP_EQK) {  /* no metamethods with a constant operand */
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        int res;
+        if (ttisinteger(rb) && ttisinteger(rc))
+          res = (ivalue(rb) == ivalue(rc));
+        else if (ttisshrstring(rb) && ttisshrstring(rc))
+          res = eqshrstr(tsvalue(rb), tsvalue(rc));
+        else
+          res = luaV_equalobj(NULL, rb, rc);
+        if (res != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
       vmcase(OP_LT) {
         Protect(
           if (luaV_lessthan(L, RKB(i), RKC(i)) != GETARG_A(i))
@@ -1128,6 +1348,7 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_CALL) {
+        l_call:
         int b = GETARG_B(i);
         int nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
@@ -1212,30 +1433,7 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_FORPREP) {
-        TValue *init = ra;
-        TValue *plimit = ra + 1;
-        TValue *pstep = ra + 2;
-        lua_Integer ilimit;
-        int stopnow;
-        if (ttisinteger(init) && ttisinteger(pstep) &&
-            forlimit(plimit, &ilimit, ivalue(pstep), &stopnow)) {
-          /* all values are integer */
-          lua_Integer initv = (stopnow ? 0 : ivalue(init));
-          setivalue(plimit, ilimit);
-          setivalue(init, intop(-, initv, ivalue(pstep)));
-        }
-        else {  /* try making all values floats */
-          lua_Number ninit; lua_Number nlimit; lua_Number nstep;
-          if (!tonumber(plimit, &nlimit))
-            luaG_runerror(L, "'for' limit must be a number");
-          setfltvalue(plimit, nlimit);
-          if (!tonumber(pstep, &nstep))
-            luaG_runerror(L, "'for' step must be a number");
-          setfltvalue(pstep, nstep);
-          if (!tonumber(init, &ninit))
-            luaG_runerror(L, "'for' initial value must be a number");
-          setfltvalue(init, luai_numsub(L, ninit, nstep));
-        }
+        luaV_forprep(L, ra);
         ci->u.l.savedpc += GETARG_sBx(i);
         vmbreak;
       }
@@ -1283,12 +1481,7 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_CLOSURE) {
-        Proto *p = cl->p->p[GETARG_Bx(i)];
-        LClosure *ncl = getcached(p, cl->upvals, base);  /* cached closure */
-        if (ncl == NULL)  /* no match? */
-          pushclosure(L, p, cl->upvals, base, ra);  /* create a new one */
-        else
-          setclLvalue(L, ra, ncl);  /* push cashed closure */
+        luaV_closure(L, cl->p->p[GETARG_Bx(i)], cl, base, ra);
         checkGC(L, ra + 1);
         vmbreak;
       }
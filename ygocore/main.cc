@@ -1,5 +1,6 @@
 #include "wrapper.h"
 #include "core/card.h"
+#include "core/field.h"
 #include "core/mtrandom.h"
 #include <nan.h>
 #include <cstdio>
@@ -7,6 +8,14 @@
 
 namespace ny {
 
+// `process` flags: ocgcore's (its result >> 16), and those of the bindings.
+static constexpr uint32 PROCESS_FLAG_END     = PROCESSOR_END >> 16;
+static constexpr uint32 PROCESS_FLAG_ABORTED = 0x100;
+static constexpr uint32 PROCESS_FLAG_MEMORY  = 0x200;
+
+static_assert((((PROCESSOR_WAITING | PROCESSOR_END) >> 16) & (PROCESS_FLAG_ABORTED | PROCESS_FLAG_MEMORY)) == 0,
+              "flags of the bindings clash with ocgcore's");
+
 static inline
 const char *to_c_string(const v8::String::Utf8Value &value)
 {
@@ -173,6 +182,7 @@ NAN_METHOD(startDuel)
   CHECK_INT(1, options, int32);
 
   start_duel(duel, options);
+  duel_state_changed(duel);
 }
 
 NAN_METHOD(endDuel)
@@ -195,18 +205,32 @@ NAN_METHOD(setPlayerInfo)
   GET_INTEGER_PROP(obj, draw,   int32);
 
   set_player_info(duel, player, lp, start, draw);
+  duel_state_changed(duel);
 }
 
 NAN_METHOD(process)
 {
   CHECK_DUEL(0);
 
-  const auto process_result = ::process(duel);
-  const auto message_length = process_result & 0xFFFF;
-  const auto process_flags  = process_result >> 16;
+  uint32 message_length = 0;
+  uint32 process_flags  = PROCESS_FLAG_ABORTED | PROCESS_FLAG_END;
 
   byte buff[0x1000];
-  get_message(duel, buff);
+  if (duel_begin_step(duel)) {
+    const auto process_result = ::process(duel);
+    duel_state_changed(duel);
+    message_length = process_result & 0xFFFF;
+    process_flags  = process_result >> 16;
+
+    if (duel_end_step(duel)) {
+      process_flags |= PROCESS_FLAG_ABORTED | PROCESS_FLAG_END;
+    }
+    if (duel_memory_exceeded(duel)) {
+      process_flags |= PROCESS_FLAG_MEMORY;
+    }
+
+    get_message(duel, buff);
+  }
 
   auto buffer_obj = Nan::CopyBuffer((char *)buff, message_length).ToLocalChecked();
   auto result_obj = Nan::New<v8::Object>();
@@ -232,8 +256,8 @@ NAN_METHOD(queryCard)
   GET_INTEGER_PROP(queryCardOptions, sequence,   uint32);
   GET_PROP(queryCardOptions, useCache, Boolean);
 
-  byte query_buffer[0x4000];
-  auto length = query_card(duel, player, location, sequence, queryFlags, query_buffer, useCache);
+  byte query_buffer[query_buffer_size];
+  auto length = duel_query_card(duel, player, location, sequence, queryFlags, query_buffer, useCache);
 
   info.GetReturnValue().Set(Nan::CopyBuffer((char *)query_buffer, length).ToLocalChecked());
 }
@@ -250,8 +274,8 @@ NAN_METHOD(queryFieldCard)
   GET_INTEGER_PROP(queryOptions, queryFlags, uint32);
   GET_PROP(queryOptions, useCache, Boolean);
 
-  byte query_buffer[0x4000];
-  auto length = query_field_card(duel, player, location, queryFlags, query_buffer, useCache);
+  byte query_buffer[query_buffer_size];
+  auto length = duel_query_field_card(duel, player, location, queryFlags, query_buffer, useCache);
 
   info.GetReturnValue().Set(Nan::CopyBuffer((char *)query_buffer, length).ToLocalChecked());
 }
@@ -271,7 +295,270 @@ NAN_METHOD(queryFieldInfo)
 {
   CHECK_DUEL(0);
 
-  return Nan::ThrowError("not impl!");
+  byte query_buffer[query_buffer_size];
+  auto length = query_field_info(duel, query_buffer);
+
+  info.GetReturnValue().Set(Nan::CopyBuffer((char *)query_buffer, length).ToLocalChecked());
+}
+
+NAN_METHOD(querySnapshot)
+{
+  CHECK_DUEL(0);
+  CHECK_INT(1, queryFlags, uint32);
+
+  const auto snapshot = duel_query_snapshot(duel, queryFlags);
+
+  info.GetReturnValue().Set(Nan::CopyBuffer((const char *)snapshot.data(), snapshot.size()).ToLocalChecked());
+}
+
+NAN_METHOD(getRevision)
+{
+  CHECK_DUEL(0);
+
+  info.GetReturnValue().Set(Nan::New(duel_revision(duel)));
+}
+
+NAN_METHOD(queryChangesSince)
+{
+  CHECK_DUEL(0);
+  CHECK_INT(1, revision, uint32);
+  CHECK_INT(2, queryFlags, uint32);
+
+  const auto changes = duel_query_changes(duel, revision, queryFlags);
+
+  info.GetReturnValue().Set(Nan::CopyBuffer((const char *)changes.data(), changes.size()).ToLocalChecked());
+}
+
+NAN_METHOD(setGCMode)
+{
+  CHECK_DUEL(0);
+  CHECK_ARG(1, String);
+
+  v8::String::Utf8Value hold_mode(arg1);
+  const std::string mode = to_c_string(hold_mode);
+
+  if (mode == "generational") {
+    duel_set_gc_mode(duel, true);
+  } else if (mode == "incremental") {
+    duel_set_gc_mode(duel, false);
+  } else {
+    return Nan::ThrowTypeError("gc mode should be either 'generational' or 'incremental'");
+  }
+}
+
+NAN_METHOD(setGCPolicy)
+{
+  CHECK_DUEL(0);
+  CHECK_ARG(1, String);
+
+  v8::String::Utf8Value hold_policy(arg1);
+  const std::string policy = to_c_string(hold_policy);
+
+  if (policy == "idle") {
+    duel_set_gc_deferred(duel, true);
+  } else if (policy == "auto") {
+    duel_set_gc_deferred(duel, false);
+  } else {
+    return Nan::ThrowTypeError("gc policy should be either 'auto' or 'idle'");
+  }
+}
+
+NAN_METHOD(collectIdle)
+{
+  CHECK_DUEL(0);
+  CHECK_ARG(1, Number);
+
+  const auto budget_ms = arg1->NumberValue();
+  const auto completed = duel_collect_idle(duel, budget_ms);
+
+  info.GetReturnValue().Set(Nan::New(completed));
+}
+
+NAN_METHOD(getGCCount)
+{
+  CHECK_DUEL(0);
+
+  info.GetReturnValue().Set(Nan::New(duel_gc_count(duel)));
+}
+
+NAN_METHOD(getMemoryUsage)
+{
+  CHECK_DUEL(0);
+
+  const auto usage = duel_memory_usage(duel);
+
+  auto usage_obj = Nan::New<v8::Object>();
+
+  usage_obj->Set( Nan::New("used").ToLocalChecked()
+                , Nan::New(usage.used));
+  usage_obj->Set( Nan::New("reserved").ToLocalChecked()
+                , Nan::New(usage.reserved));
+  usage_obj->Set( Nan::New("limit").ToLocalChecked()
+                , Nan::New(usage.limit));
+
+  info.GetReturnValue().Set(usage_obj);
+}
+
+NAN_METHOD(setMemoryLimit)
+{
+  CHECK_DUEL(0);
+  CHECK_ARG(1, Number);
+
+  duel_set_memory_limit(duel, arg1->NumberValue());
+}
+
+NAN_METHOD(setRegionTeardown)
+{
+  CHECK_DUEL(0);
+  CHECK_ARG(1, Boolean);
+
+  const auto enabled = arg1->BooleanValue();
+
+  info.GetReturnValue().Set(Nan::New(duel_set_region_teardown(duel, enabled)));
+}
+
+NAN_METHOD(setDeferredFree)
+{
+  CHECK_DUEL(0);
+  CHECK_ARG(1, Boolean);
+
+  const auto enabled = arg1->BooleanValue();
+
+  info.GetReturnValue().Set(Nan::New(duel_set_deferred_free(duel, enabled)));
+}
+
+NAN_METHOD(freezeConstants)
+{
+  CHECK_DUEL(0);
+
+  info.GetReturnValue().Set(Nan::New(duel_freeze_constants(duel)));
+}
+
+NAN_METHOD(stripDebugInfo)
+{
+  CHECK_DUEL(0);
+
+  duel_strip_debug_info(duel);
+}
+
+NAN_METHOD(precompileAll)
+{
+  unsigned threads      = 0;
+  bool frozen_constants = false;
+
+  if (info.Length() > 0 && info[0]->IsObject()) {
+    const auto options = info[0].As<v8::Object>();
+
+    const auto ref_threads = options->Get(Nan::New("threads").ToLocalChecked());
+    if (!ref_threads.IsEmpty() && ref_threads->IsNumber())
+      threads = to_integer<uint32>(ref_threads, 0);
+
+    const auto ref_frozen = options->Get(Nan::New("frozenConstants").ToLocalChecked());
+    if (!ref_frozen.IsEmpty() && ref_frozen->IsBoolean())
+      frozen_constants = ref_frozen->BooleanValue();
+  }
+
+  const auto result = precompile_all_scripts(threads, frozen_constants);
+
+  auto errors_obj = Nan::New<v8::Array>(result.errors.size());
+  for (size_t i = 0; i < result.errors.size(); ++i) {
+    auto error_obj = Nan::New<v8::Object>();
+
+    error_obj->Set( Nan::New("name").ToLocalChecked()
+                  , Nan::New(result.errors[i].first).ToLocalChecked());
+    error_obj->Set( Nan::New("message").ToLocalChecked()
+                  , Nan::New(result.errors[i].second).ToLocalChecked());
+    errors_obj->Set(i, error_obj);
+  }
+
+  auto result_obj = Nan::New<v8::Object>();
+
+  result_obj->Set( Nan::New("compiled").ToLocalChecked()
+                 , Nan::New(result.compiled));
+  result_obj->Set( Nan::New("errors").ToLocalChecked()
+                 , errors_obj);
+
+  info.GetReturnValue().Set(result_obj);
+}
+
+NAN_METHOD(setStepBudget)
+{
+  CHECK_DUEL(0);
+  CHECK_ARG(1, Object);
+
+  const auto budget = arg1.As<v8::Object>();
+
+  double instructions = 0;
+  double time_ms      = 0;
+
+  const auto ref_instructions = budget->Get(Nan::New("instructions").ToLocalChecked());
+  if (!ref_instructions.IsEmpty() && ref_instructions->IsNumber())
+    instructions = ref_instructions->NumberValue();
+
+  const auto ref_time = budget->Get(Nan::New("timeMs").ToLocalChecked());
+  if (!ref_time.IsEmpty() && ref_time->IsNumber())
+    time_ms = ref_time->NumberValue();
+
+  duel_set_step_budget(duel, instructions, time_ms);
+}
+
+NAN_METHOD(getAbortInfo)
+{
+  CHECK_DUEL(0);
+
+  const auto abort = duel_abort_info(duel);
+  if (!abort.aborted)
+    return info.GetReturnValue().Set(Nan::Null());
+
+  auto result_obj = Nan::New<v8::Object>();
+
+  result_obj->Set( Nan::New("reason").ToLocalChecked()
+                 , Nan::New(abort.reason).ToLocalChecked());
+  result_obj->Set( Nan::New("code").ToLocalChecked()
+                 , Nan::New(abort.code));
+  result_obj->Set( Nan::New("chunk").ToLocalChecked()
+                 , Nan::New(abort.chunk).ToLocalChecked());
+  result_obj->Set( Nan::New("line").ToLocalChecked()
+                 , Nan::New(abort.line));
+
+  info.GetReturnValue().Set(result_obj);
+}
+
+NAN_METHOD(startProfiler)
+{
+  CHECK_DUEL(0);
+
+  int  period      = 10000;
+  bool count_calls = false;
+
+  if (info.Length() > 1 && info[1]->IsObject()) {
+    const auto options = info[1].As<v8::Object>();
+
+    const auto ref_period = options->Get(Nan::New("period").ToLocalChecked());
+    if (!ref_period.IsEmpty() && ref_period->IsNumber()) {
+      const auto value = ref_period->NumberValue();
+      if (!(value >= 1))
+        return Nan::ThrowRangeError("period should be at least 1");
+
+      // larger periods are capped by duel_start_profiler.
+      period = value < 1e9 ? static_cast<int>(value) : 1000000000;
+    }
+
+    const auto ref_calls = options->Get(Nan::New("calls").ToLocalChecked());
+    if (!ref_calls.IsEmpty() && ref_calls->IsBoolean())
+      count_calls = ref_calls->BooleanValue();
+  }
+
+  duel_start_profiler(duel, period, count_calls);
+}
+
+NAN_METHOD(stopProfiler)
+{
+  CHECK_DUEL(0);
+
+  const auto report = duel_stop_profiler(duel);
+
+  info.GetReturnValue().Set(Nan::CopyBuffer((const char *)report.data(), report.size()).ToLocalChecked());
 }
 
 NAN_METHOD(newCard)
@@ -289,6 +576,7 @@ NAN_METHOD(newCard)
   GET_INTEGER_PROP(new_card, position, uint8);
 
   ::new_card(duel, code, owner, player, location, sequence, position);
+  duel_state_changed(duel);
 }
 
 NAN_METHOD(setResponse)
@@ -334,6 +622,24 @@ NAN_MODULE_INIT(Init)
   NAN_EXPORT(target, queryFieldCard);
   NAN_EXPORT(target, queryFieldCount);
   NAN_EXPORT(target, queryFieldInfo);
+  NAN_EXPORT(target, querySnapshot);
+  NAN_EXPORT(target, getRevision);
+  NAN_EXPORT(target, queryChangesSince);
+  NAN_EXPORT(target, setGCMode);
+  NAN_EXPORT(target, setGCPolicy);
+  NAN_EXPORT(target, collectIdle);
+  NAN_EXPORT(target, getGCCount);
+  NAN_EXPORT(target, getMemoryUsage);
+  NAN_EXPORT(target, setMemoryLimit);
+  NAN_EXPORT(target, setRegionTeardown);
+  NAN_EXPORT(target, setDeferredFree);
+  NAN_EXPORT(target, freezeConstants);
+  NAN_EXPORT(target, stripDebugInfo);
+  NAN_EXPORT(target, precompileAll);
+  NAN_EXPORT(target, setStepBudget);
+  NAN_EXPORT(target, getAbortInfo);
+  NAN_EXPORT(target, startProfiler);
+  NAN_EXPORT(target, stopProfiler);
 
   // setup script reader & card reader
   initialize_global_storage();
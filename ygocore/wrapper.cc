@@ -1,16 +1,31 @@
 #include "wrapper.h"
 #include "core/card.h"
+#include "core/duel.h"
+#include "core/interpreter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <map>
+#include <mutex>
+#include <new>
+#include <set>
 #include <string>
 #include <cstring>
+#include <cstdlib>
+#include <limits>
 #include <vector>
 #include <stack>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 
 namespace ny {
 
 struct Storage
 {
   std::map<std::string, std::vector<byte>> script_content_by_name;
+  std::map<std::string, std::vector<byte>> script_bytecode_by_name;
   std::map<uint32, card_data>              card_data_by_code;
   std::map<duel_instance_id_t, ptr>        duel_by_id;
   std::stack<duel_instance_id_t>           reusable_id_list;
@@ -69,6 +84,9 @@ struct Storage
     script_content_by_name[script_name] =
       std::vector<byte>( script_content
                        , script_content + len);
+
+    // compiled from the previous content.
+    script_bytecode_by_name.erase(script_name);
   }
 };
 
@@ -117,6 +135,13 @@ static
 byte *try_script( const char *script_name
                 , int        *script_len)
 {
+  // lua_load tells bytecode from source by its first byte.
+  const auto compiled = global_storage.script_bytecode_by_name.find(script_name);
+  if (compiled != global_storage.script_bytecode_by_name.cend()) {
+    *script_len = compiled->second.size();
+    return compiled->second.data();
+  }
+
   const auto found = global_storage.script_content_by_name.find(script_name);
   if (found == global_storage.script_content_by_name.cend())
     return nullptr;
@@ -157,4 +182,1177 @@ void initialize_global_storage()
   set_script_reader(read_script_from_global_storage);
 }
 
+static
+lua_State *duel_lua_state(ptr duel_ptr)
+{
+  return reinterpret_cast<duel *>(duel_ptr)->lua->lua_state;
+}
+
+void duel_set_gc_mode(ptr duel_ptr, bool generational)
+{
+  lua_gc(duel_lua_state(duel_ptr), generational ? LUA_GCGEN : LUA_GCINC, 0);
+}
+
+void duel_set_gc_deferred(ptr duel_ptr, bool deferred)
+{
+  lua_gc(duel_lua_state(duel_ptr), deferred ? LUA_GCSTOP : LUA_GCRESTART, 0);
+}
+
+bool duel_collect_idle(ptr duel_ptr, double budget_ms)
+{
+  using clock = std::chrono::steady_clock;
+
+  const auto L        = duel_lua_state(duel_ptr);
+  const auto budget   = std::chrono::duration<double, std::milli>(budget_ms);
+  const auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(budget);
+
+  // LUA_GCSTEP runs the collector even when it is stopped.
+  // each small step does about the work of allocating a few KB, in
+  // generational mode too.
+  do {
+    if (lua_gc(L, LUA_GCSTEP, 0)) {
+      return true;
+    }
+  } while (clock::now() < deadline);
+
+  return false;
+}
+
+double duel_gc_count(ptr duel_ptr)
+{
+  const auto L = duel_lua_state(duel_ptr);
+
+  return lua_gc(L, LUA_GCCOUNT, 0) * 1024.0 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+memory_usage duel_memory_usage(ptr duel_ptr)
+{
+  const auto L = duel_lua_state(duel_ptr);
+
+  size_t used = 0, reserved = 0;
+  if (!luaL_heapusage(L, &used, &reserved)) {
+    used = reserved = static_cast<size_t>(duel_gc_count(duel_ptr));
+  }
+
+  memory_usage usage;
+  usage.used     = static_cast<double>(used);
+  usage.reserved = static_cast<double>(reserved);
+
+  usage.limit    = static_cast<double>(lua_getmemlimit(L));
+
+  return usage;
+}
+
+void duel_set_memory_limit(ptr duel_ptr, double limit)
+{
+  lua_setmemlimit(duel_lua_state(duel_ptr), limit > 0 ? static_cast<size_t>(limit) : 0);
+}
+
+bool duel_memory_exceeded(ptr duel_ptr)
+{
+  return lua_memexceeded(duel_lua_state(duel_ptr)) != 0;
+}
+
+bool duel_set_region_teardown(ptr duel_ptr, bool enabled)
+{
+  const auto L = duel_lua_state(duel_ptr);
+
+  if (!luaL_heapusage(L, nullptr, nullptr))
+    return false;
+
+  lua_setrelease(L, enabled ? luaL_heaprelease : nullptr);
+  return true;
+}
+
+// memory freed by duels, waiting for the thread that gives it back.
+struct FreeQueue
+{
+  static constexpr size_t max_queued = 64 << 20; ///> bytes
+
+  std::mutex                             mutex;
+  std::condition_variable                wake;
+  std::vector<std::pair<void *, size_t>> batches; ///> (blocks, bytes)
+  size_t                                 queued = 0;
+  bool                                   stop   = false;
+  std::thread                            worker;
+
+  ~FreeQueue()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    wake.notify_one();
+    if (worker.joinable())
+      worker.join();
+  }
+};
+
+static FreeQueue free_queue;
+
+static
+void free_worker()
+{
+  std::unique_lock<std::mutex> lock(free_queue.mutex);
+
+  for (;;) {
+    free_queue.wake.wait(lock, [] { return free_queue.stop || !free_queue.batches.empty(); });
+    if (free_queue.batches.empty())
+      return;
+
+    auto batches = std::move(free_queue.batches);
+    free_queue.batches.clear();
+    lock.unlock();
+
+    size_t freed = 0;
+    for (const auto &batch : batches) {
+      luaL_freeblocks(batch.first);
+      freed += batch.second;
+    }
+
+    lock.lock();
+    free_queue.queued -= freed;
+  }
+}
+
+static
+void defer_free(void *, void *blocks, size_t size)
+{
+  {
+    std::lock_guard<std::mutex> lock(free_queue.mutex);
+
+    if (free_queue.queued + size <= FreeQueue::max_queued) {
+      if (!free_queue.worker.joinable())
+        free_queue.worker = std::thread(free_worker);
+
+      free_queue.batches.emplace_back(blocks, size);
+      free_queue.queued += size;
+      free_queue.wake.notify_one();
+      return;
+    }
+  }
+
+  // the freeing thread is behind: do not let the queue grow.
+  luaL_freeblocks(blocks);
+}
+
+bool duel_set_deferred_free(ptr duel_ptr, bool enabled)
+{
+  return luaL_heapdefer(duel_lua_state(duel_ptr), enabled ? defer_free : nullptr, nullptr);
+}
+
+static
+int freeze_constants(lua_State *L)
+{
+  int len = 0;
+  const auto script = read_script_from_global_storage("./script/constant.lua", &len);
+  if (len == 0)
+    return 0;
+
+  // start over: constant.lua must neither see nor thaw the previous values.
+  lua_pushnil(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_FROZENTABLE);
+
+  // run constant.lua again with an empty _ENV, to collect exactly its names.
+  const int top = lua_gettop(L);
+  if (luaL_loadbuffer(L, reinterpret_cast<const char *>(script), len, "=constant.lua") != LUA_OK) {
+    lua_settop(L, top);
+    return 0;
+  }
+  lua_newtable(L);
+  lua_pushvalue(L, -1);
+  lua_setupvalue(L, -3, 1);
+  lua_insert(L, -2);
+  if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+    lua_settop(L, top);
+    return 0;
+  }
+
+  const int names   = top + 1;
+  const int frozen  = top + 2;
+  const int globals = top + 3;
+  lua_newtable(L);
+  lua_pushglobaltable(L);
+
+  int count = 0;
+  lua_pushnil(L);
+  while (lua_next(L, names)) {
+    if (lua_type(L, -2) == LUA_TSTRING && lua_type(L, -1) == LUA_TNUMBER) {
+      lua_pushvalue(L, -2);
+      lua_rawget(L, globals);
+
+      // skip names the duel has changed since constant.lua ran.
+      if (lua_rawequal(L, -1, -2)) {
+        lua_pushvalue(L, -3);
+        lua_pushvalue(L, -3);
+        lua_rawset(L, frozen);
+        ++count;
+      }
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
+
+  lua_pushvalue(L, frozen);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_FROZENTABLE);
+  lua_settop(L, top);
+
+  return count;
+}
+
+int duel_freeze_constants(ptr duel_ptr)
+{
+  return freeze_constants(duel_lua_state(duel_ptr));
+}
+
+static
+const char *read_debug_info(void *, const char *source, size_t *size)
+{
+  int len = 0;
+  const auto script = read_script_from_global_storage(source, &len);
+
+  *size = len;
+  return len > 0 ? reinterpret_cast<const char *>(script) : nullptr;
+}
+
+void duel_strip_debug_info(ptr duel_ptr)
+{
+  lua_setdebugreader(duel_lua_state(duel_ptr), read_debug_info, nullptr);
+}
+
+static
+int write_bytecode(lua_State *, const void *p, size_t sz, void *ud)
+{
+  auto &bytecode   = *static_cast<std::vector<byte> *>(ud);
+  const auto bytes = static_cast<const byte *>(p);
+
+  bytecode.insert(bytecode.end(), bytes, bytes + sz);
+  return 0;
+}
+
+// constant.lua assigns to every frozen name: compiling it with them frozen
+// would thaw them all for the scripts compiled after it.
+static
+bool defines_constants(const std::string &script_name)
+{
+  static const std::string constant_script = "constant.lua";
+
+  return script_name.size() >= constant_script.size()
+      && script_name.compare( script_name.size() - constant_script.size()
+                            , constant_script.size()
+                            , constant_script) == 0;
+}
+
+// the core loads every script as "./script/<file>" and uses that as the
+// chunk name; registered names match it by a suffix after a '/'.
+static
+std::string core_script_name(const std::string &script_name)
+{
+  const auto slash = script_name.find_last_of('/');
+
+  return "./script/" + script_name.substr(slash == std::string::npos ? 0 : slash + 1);
+}
+
+struct precompile_job
+{
+  const std::string       *name;
+  const std::vector<byte> *content;
+  std::vector<byte>        bytecode;
+  std::string              error;
+};
+
+// with `thawed`, a worker only loads the scripts, collecting the frozen
+// names they thaw; otherwise it compiles them, with the names of `thaw`
+// thawed first.
+static
+void precompile_worker( std::vector<precompile_job>  &jobs
+                      , std::atomic<size_t>          &next_job
+                      , bool                          frozen_constants
+                      , const std::set<std::string>  &thaw
+                      , std::set<std::string>        *thawed)
+{
+  // a scratch state per thread: lua states share nothing.
+  const auto L = luaL_newstate();
+  std::vector<std::string> frozen_names;
+  if (frozen_constants) {
+    // set the globals up like a duel does, then freeze them.
+    int len = 0;
+    const auto script = read_script_from_global_storage("./script/constant.lua", &len);
+    if (len > 0
+        && luaL_loadbuffer(L, reinterpret_cast<const char *>(script), len, "=constant.lua") == LUA_OK
+        && lua_pcall(L, 0, 0, 0) == LUA_OK)
+      freeze_constants(L);
+    lua_settop(L, 0);
+
+    if (lua_getfield(L, LUA_REGISTRYINDEX, LUA_FROZENTABLE) == LUA_TTABLE) {
+      for (const auto &name : thaw) {
+        lua_pushnil(L);
+        lua_setfield(L, -2, name.c_str());
+      }
+      lua_pushnil(L);
+      while (lua_next(L, -2)) {
+        lua_pop(L, 1);
+        frozen_names.emplace_back(lua_tostring(L, -1));
+      }
+    }
+    lua_settop(L, 0);
+  }
+
+  for (auto i = next_job++; i < jobs.size(); i = next_job++) {
+    auto &job = jobs[i];
+    const auto content = reinterpret_cast<const char *>(job.content->data());
+
+    const bool unfreeze = frozen_constants && defines_constants(*job.name);
+    if (unfreeze) {
+      lua_getfield(L, LUA_REGISTRYINDEX, LUA_FROZENTABLE);
+      lua_pushnil(L);
+      lua_setfield(L, LUA_REGISTRYINDEX, LUA_FROZENTABLE);
+    }
+
+    const auto chunk_name = core_script_name(*job.name);
+    if (luaL_loadbuffer(L, content, job.content->size(), chunk_name.c_str()) != LUA_OK) {
+      if (!thawed)
+        job.error = lua_tostring(L, -1);
+    } else if (!thawed) {
+      lua_dump(L, write_bytecode, &job.bytecode, 0);
+    }
+
+    if (unfreeze) {
+      lua_pushvalue(L, 1);
+      lua_setfield(L, LUA_REGISTRYINDEX, LUA_FROZENTABLE);
+    }
+    lua_settop(L, 0);
+  }
+
+  // a name stays thawed once a script thaws it: what is no longer frozen
+  // at the end was thawed by the scripts of this worker.
+  if (thawed && lua_getfield(L, LUA_REGISTRYINDEX, LUA_FROZENTABLE) == LUA_TTABLE) {
+    for (const auto &name : frozen_names) {
+      if (lua_getfield(L, -1, name.c_str()) == LUA_TNIL)
+        thawed->insert(name);
+      lua_pop(L, 1);
+    }
+  }
+
+  lua_close(L);
+}
+
+// runs `precompile_worker` on all the jobs, on `threads` threads (this
+// one included). returns the names the scripts thaw, with `find_thawed`.
+static
+std::set<std::string> run_precompile_workers( std::vector<precompile_job>  &jobs
+                                            , unsigned                      threads
+                                            , bool                          frozen_constants
+                                            , const std::set<std::string>  &thaw
+                                            , bool                          find_thawed)
+{
+  std::atomic<size_t> next_job(0);
+  std::vector<std::set<std::string>> thawed(threads);
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads; ++i) {
+    workers.emplace_back( precompile_worker
+                        , std::ref(jobs)
+                        , std::ref(next_job)
+                        , frozen_constants
+                        , std::cref(thaw)
+                        , find_thawed ? &thawed[i] : nullptr);
+  }
+  precompile_worker(jobs, next_job, frozen_constants, thaw, find_thawed ? &thawed[0] : nullptr);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  std::set<std::string> all;
+  for (const auto &names : thawed) {
+    all.insert(names.cbegin(), names.cend());
+  }
+  return all;
+}
+
+precompile_result precompile_all_scripts(unsigned threads, bool frozen_constants)
+{
+  std::vector<precompile_job> jobs;
+  for (const auto &script : global_storage.script_content_by_name) {
+    jobs.push_back({ &script.first, &script.second, {}, {} });
+  }
+
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<unsigned>(threads, std::max<size_t>(jobs.size(), 1));
+
+  // constant.lua must be read as source by 'freeze_constants'.
+  global_storage.script_bytecode_by_name.clear();
+
+  // a script that assigns to a frozen name thaws it for the scripts
+  // compiled after it, and which come after depends on the threads (and
+  // in a duel, on its cards). so the names any script thaws are found
+  // first, and every script is compiled with all of them thawed.
+  std::set<std::string> thawed;
+  if (frozen_constants)
+    thawed = run_precompile_workers(jobs, threads, true, {}, true);
+  run_precompile_workers(jobs, threads, frozen_constants, thawed, false);
+
+  precompile_result result;
+  for (auto &job : jobs) {
+    if (job.error.empty()) {
+      global_storage.script_bytecode_by_name[*job.name] = std::move(job.bytecode);
+      ++result.compiled;
+    } else {
+      result.errors.emplace_back(*job.name, std::move(job.error));
+    }
+  }
+
+  return result;
+}
+
+// objects kept in a duel's lua registry, as userdata: they go with the duel.
+template <typename T>
+static
+int free_object(lua_State *L)
+{
+  static_cast<T *>(lua_touserdata(L, 1))->~T();
+  return 0;
+}
+
+template <typename T>
+static
+T *new_object(lua_State *L, const void *key)
+{
+  const auto object = new (lua_newuserdata(L, sizeof(T))) T();
+
+  lua_newtable(L);
+  lua_pushcfunction(L, free_object<T>);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+
+  return object;
+}
+
+template <typename T>
+static
+T *find_object(lua_State *L, const void *key)
+{
+  lua_rawgetp(L, LUA_REGISTRYINDEX, key);
+  const auto object = static_cast<T *>(lua_touserdata(L, -1));
+  lua_pop(L, 1);
+
+  return object;
+}
+
+static
+void drop_object(lua_State *L, const void *key)
+{
+  lua_pushnil(L);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+}
+
+// card scripts are loaded as "./script/c<code>.lua".
+static
+uint32 card_code_of(const std::string &source)
+{
+  const auto slash = source.find_last_of('/');
+  const auto name  = source.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+
+  if (name[0] != 'c' || name[1] < '0' || name[1] > '9')
+    return 0;
+
+  char *end = nullptr;
+  const auto code = std::strtoul(name + 1, &end, 10);
+
+  return std::strcmp(end, ".lua") == 0 ? static_cast<uint32>(code) : 0;
+}
+
+// name of a script for reports ('@' or '=' dropped).
+static
+std::string chunk_name_of(const std::string &source)
+{
+  const bool prefixed = !source.empty() && (source[0] == '@' || source[0] == '=');
+
+  return source.substr(prefixed ? 1 : 0);
+}
+
+// limits of a duel's steps, and why it was aborted.
+struct StepBudget
+{
+  using clock = std::chrono::steady_clock;
+
+  static constexpr int check_interval = 1000; ///> lua instructions between checks
+
+  double            max_instructions = 0;   ///> 0: no limit
+  clock::duration   max_time         = {};  ///> 0: no limit
+  bool              in_step          = false;
+  double            instructions     = 0;   ///> run in this step
+  clock::time_point deadline;
+  abort_info        abort;
+};
+
+// samples of a duel's scripts.
+struct Profiler
+{
+  using clock = std::chrono::steady_clock;
+
+  struct source_info
+  {
+    std::string name;
+    uint32      code; ///> card code, 0 if not a card script
+  };
+
+  struct line_stats
+  {
+    uint32 calls   = 0;
+    uint32 samples = 0;
+    uint64 time_ns = 0;
+  };
+
+  using function_key = std::pair<uint32, int>;        ///> (source, line defined)
+  using line_key     = std::tuple<uint32, int, int>;  ///> (source, line defined, line)
+
+  static constexpr int max_period = 1 << 24;  ///> keeps `next_count` within int
+
+  int                                      period      = 0;
+  bool                                     count_calls = false;
+  int                                      countdown   = 0;  ///> instructions until the next sample
+  uint32                                   random      = 1;
+  std::vector<source_info>                 sources;
+  std::unordered_map<std::string, uint32>  source_ids;
+  std::unordered_map<const char *, uint32> recent_sources; ///> by address of the source string
+  std::map<function_key, std::string>      function_names;
+  std::map<line_key, line_stats>           lines;
+  clock::time_point                        last_sample;
+  bool                                     timing = false;  ///> `last_sample` is in this step
+
+  // instructions until the next sample: `period` on average, but not
+  // always the same, or loops of a fitting length would always be
+  // sampled at the same line.
+  int next_count()
+  {
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+
+    return period / 2 + 1 + static_cast<int>(random % static_cast<uint32>(period));
+  }
+};
+
+constexpr int Profiler::max_period; // bound to a reference by std::min
+
+static const char budget_key   = 0;
+static const char profiler_key = 0;
+
+static
+uint32 profile_source(Profiler &profiler, const char *source)
+{
+  // a source string lives as long as its functions, so its address is
+  // usually enough; check it anyway, it may have been reused.
+  const auto recent = profiler.recent_sources.find(source);
+  if (recent != profiler.recent_sources.cend()
+      && profiler.sources[recent->second].name == source)
+    return recent->second;
+
+  const auto found = profiler.source_ids.emplace(source, profiler.sources.size());
+  if (found.second) {
+    profiler.sources.push_back({ source, card_code_of(source) });
+  }
+
+  profiler.recent_sources[source] = found.first->second;
+  return found.first->second;
+}
+
+static
+std::string profile_function_name(lua_State *L, lua_Debug *ar, uint32 code)
+{
+  // card functions are fields of the card's table (c<code>.operation),
+  // and mostly called by the core, where lua knows no name for them.
+  if (code != 0) {
+    const auto table = "c" + std::to_string(code);
+
+    lua_getinfo(L, "f", ar);
+    if (lua_getglobal(L, table.c_str()) == LUA_TTABLE) {
+      lua_pushnil(L);
+      while (lua_next(L, -2)) {
+        if (lua_type(L, -2) == LUA_TSTRING && lua_rawequal(L, -1, -4)) {
+          const auto name = table + "." + lua_tostring(L, -2);
+          lua_pop(L, 4);
+          return name;
+        }
+        lua_pop(L, 1);
+      }
+    }
+    lua_pop(L, 2);
+  }
+
+  lua_getinfo(L, "n", ar);
+  return ar->name ? ar->name : "";
+}
+
+// `ar` has the source of a lua function ("S").
+static
+Profiler::line_stats &profile_line(lua_State *L, lua_Debug *ar, Profiler &profiler, int line)
+{
+  const auto source   = profile_source(profiler, ar->source);
+  const auto function = Profiler::function_key(source, ar->linedefined);
+  if (profiler.function_names.find(function) == profiler.function_names.cend()) {
+    profiler.function_names[function] =
+      profile_function_name(L, ar, profiler.sources[source].code);
+  }
+
+  return profiler.lines[Profiler::line_key(source, ar->linedefined, line)];
+}
+
+static
+void profile_sample(lua_State *L, lua_Debug *ar, Profiler &profiler, Profiler::clock::time_point now)
+{
+  lua_getinfo(L, "Sl", ar);
+
+  auto &stats = profile_line(L, ar, profiler, ar->currentline);
+  ++stats.samples;
+  if (profiler.timing) {
+    stats.time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(now - profiler.last_sample).count();
+  }
+  profiler.last_sample = now;
+  profiler.timing      = true;
+}
+
+static
+void profile_call(lua_State *L, lua_Debug *ar, Profiler &profiler)
+{
+  lua_getinfo(L, "S", ar);
+  if (ar->what[0] == 'C')
+    return; // only calls to lua functions are counted.
+
+  // calls are counted on the line where the function is defined.
+  ++profile_line(L, ar, profiler, ar->linedefined).calls;
+}
+
+static void duel_hook(lua_State *L, lua_Debug *ar);
+
+// (re)set the hook of thread `L` for what its duel needs. the threads a
+// duel creates afterwards get the hook of its main thread.
+static
+void arm_hook(lua_State *L, const StepBudget *budget, const Profiler *profiler)
+{
+  int mask  = 0;
+  int count = std::numeric_limits<int>::max();
+
+  if (budget) {
+    mask |= LUA_MASKCOUNT;
+    count = budget->abort.aborted ? 1 : StepBudget::check_interval;
+  }
+  if (profiler) {
+    mask |= LUA_MASKCOUNT | (profiler->count_calls ? LUA_MASKCALL : 0);
+    count = std::min(count, std::max(profiler->countdown, 1));
+  }
+
+  lua_sethook(L, mask ? duel_hook : nullptr, mask, count);
+}
+
+// fails the running script (does not return).
+static
+void abort_script(lua_State *L, const StepBudget &budget)
+{
+  luaL_where(L, 0);
+  lua_pushfstring(L, "duel aborted: step over its %s budget", budget.abort.reason.c_str());
+  lua_concat(L, 2);
+  lua_error(L);
+}
+
+static
+void charge_budget(lua_State *L, lua_Debug *ar, StepBudget &budget, int instructions)
+{
+  if (!budget.abort.aborted) {
+    // scripts run outside `process` (loading cards) are not limited.
+    if (!budget.in_step)
+      return;
+
+    budget.instructions += instructions;
+
+    const char *reason = nullptr;
+    if (budget.max_instructions > 0 && budget.instructions > budget.max_instructions)
+      reason = "instruction";
+    else if (budget.max_time != StepBudget::clock::duration::zero()
+             && StepBudget::clock::now() > budget.deadline)
+      reason = "time";
+
+    if (!reason)
+      return;
+
+    lua_getinfo(L, "Sl", ar);
+    budget.abort.aborted = true;
+    budget.abort.reason  = reason;
+    budget.abort.code    = card_code_of(ar->source);
+    budget.abort.chunk   = chunk_name_of(ar->source);
+    budget.abort.line    = ar->currentline;
+  }
+
+  // the next instruction fails again, even under a `pcall`. the error of
+  // a coroutine goes back to the thread that resumed it, so the main
+  // thread is armed too: it must not run `check_interval` more
+  // instructions first. other threads fail at their next check.
+  const auto profiler = find_object<Profiler>(L, &profiler_key);
+  arm_hook(L, &budget, profiler);
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  const auto main_thread = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  if (main_thread != L)
+    arm_hook(main_thread, &budget, profiler);
+
+  abort_script(L, budget);
+}
+
+static
+void duel_hook(lua_State *L, lua_Debug *ar)
+{
+  const auto now      = Profiler::clock::now();
+  const auto budget   = find_object<StepBudget>(L, &budget_key);
+  const auto profiler = find_object<Profiler>(L, &profiler_key);
+
+  if (ar->event != LUA_HOOKCOUNT) {
+    if (profiler && profiler->count_calls) {
+      profile_call(L, ar, *profiler);
+    } else {
+      // the profiler of this coroutine is gone.
+      arm_hook(L, budget, profiler);
+    }
+    return;
+  }
+
+  const int ran = lua_gethookcount(L);
+  if (budget) {
+    charge_budget(L, ar, *budget, ran);
+  }
+  if (profiler) {
+    profiler->countdown -= ran;
+    if (profiler->countdown <= 0) {
+      profile_sample(L, ar, *profiler, now);
+      profiler->countdown = profiler->next_count();
+    }
+  }
+
+  arm_hook(L, budget, profiler);
+}
+
+void duel_set_step_budget(ptr duel_ptr, double max_instructions, double max_ms)
+{
+  const auto L = duel_lua_state(duel_ptr);
+
+  auto budget = find_object<StepBudget>(L, &budget_key);
+  if (max_instructions <= 0 && max_ms <= 0) {
+    if (budget && !budget->abort.aborted) {
+      drop_object(L, &budget_key);
+      budget = nullptr;
+    }
+  } else {
+    if (!budget)
+      budget = new_object<StepBudget>(L, &budget_key);
+
+    budget->max_instructions = std::max(max_instructions, 0.0);
+    budget->max_time = std::chrono::duration_cast<StepBudget::clock::duration>(
+      std::chrono::duration<double, std::milli>(std::max(max_ms, 0.0)));
+  }
+
+  arm_hook(L, budget, find_object<Profiler>(L, &profiler_key));
+}
+
+bool duel_begin_step(ptr duel_ptr)
+{
+  const auto L = duel_lua_state(duel_ptr);
+
+  if (const auto budget = find_object<StepBudget>(L, &budget_key)) {
+    if (budget->abort.aborted)
+      return false;
+
+    budget->in_step      = true;
+    budget->instructions = 0;
+    budget->deadline     = StepBudget::clock::now() + budget->max_time;
+  }
+  if (const auto profiler = find_object<Profiler>(L, &profiler_key)) {
+    profiler->timing = false;
+  }
+
+  return true;
+}
+
+bool duel_end_step(ptr duel_ptr)
+{
+  const auto budget = find_object<StepBudget>(duel_lua_state(duel_ptr), &budget_key);
+  if (!budget)
+    return false;
+
+  budget->in_step = false;
+  return budget->abort.aborted;
+}
+
+abort_info duel_abort_info(ptr duel_ptr)
+{
+  const auto budget = find_object<StepBudget>(duel_lua_state(duel_ptr), &budget_key);
+
+  return budget ? budget->abort : abort_info();
+}
+
+void duel_start_profiler(ptr duel_ptr, int period, bool count_calls)
+{
+  const auto L = duel_lua_state(duel_ptr);
+
+  const auto profiler = new_object<Profiler>(L, &profiler_key);
+  profiler->period      = std::min(std::max(period, 1), Profiler::max_period);
+  profiler->count_calls = count_calls;
+  profiler->countdown   = profiler->next_count();
+
+  arm_hook(L, find_object<StepBudget>(L, &budget_key), profiler);
+}
+
+template <typename T>
+static
+void write_value(std::vector<byte> &buffer, T value)
+{
+  const auto bytes = reinterpret_cast<const byte *>(&value);
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+static
+void write_string(std::vector<byte> &buffer, const std::string &value)
+{
+  const auto len = static_cast<uint16_t>(std::min<size_t>(value.size(), 0xFFFF));
+
+  write_value(buffer, len);
+  buffer.insert(buffer.end(), value.begin(), value.begin() + len);
+}
+
+std::vector<byte> duel_stop_profiler(ptr duel_ptr)
+{
+  const auto L        = duel_lua_state(duel_ptr);
+  const auto profiler = find_object<Profiler>(L, &profiler_key);
+
+  std::vector<byte> report;
+  if (!profiler)
+    return report;
+
+  write_value<uint32>(report, profiler->period);
+  write_value<uint32>(report, profiler->lines.size());
+
+  for (const auto &line : profiler->lines) {
+    const auto &source = profiler->sources[std::get<0>(line.first)];
+    const auto &name   = profiler->function_names[
+      Profiler::function_key(std::get<0>(line.first), std::get<1>(line.first))];
+
+    write_value<uint32>(report, source.code);
+    write_value<int32>(report, std::get<1>(line.first));
+    write_value<int32>(report, std::get<2>(line.first));
+    write_value<uint32>(report, line.second.calls);
+    write_value<uint32>(report, line.second.samples);
+    write_value<uint32>(report, static_cast<uint32>(line.second.time_ns / 1000));
+    write_string(report, name);
+
+    // other chunks are told apart by their name.
+    write_string(report, source.code != 0 ? std::string() : chunk_name_of(source.name));
+  }
+
+  drop_object(L, &profiler_key);
+  arm_hook(L, find_object<StepBudget>(L, &budget_key), nullptr);
+
+  return report;
+}
+
+// results of queries made since the duel's state last changed.
+struct QueryCache
+{
+  ///> (player, location, sequence or -1 for the whole location, query flags)
+  using key = std::tuple<uint8, uint8, int32, uint32>;
+
+  uint32                           revision = 1; ///> of the duel's state
+  std::map<key, std::vector<byte>> results;
+};
+
+static const char query_cache_key = 0;
+
+static
+QueryCache &query_cache(lua_State *L)
+{
+  auto cache = find_object<QueryCache>(L, &query_cache_key);
+  if (!cache)
+    cache = new_object<QueryCache>(L, &query_cache_key);
+
+  return *cache;
+}
+
+void duel_state_changed(ptr duel_ptr)
+{
+  auto &cache = query_cache(duel_lua_state(duel_ptr));
+
+  ++cache.revision;
+  cache.results.clear();
+}
+
+uint32 duel_revision(ptr duel_ptr)
+{
+  return query_cache(duel_lua_state(duel_ptr)).revision;
+}
+
+// a query without `use_cache` only depends on the duel's state, so it is
+// run once per state; the core's `use_cache` depends on earlier queries.
+template <typename Query>
+static
+int32 cached_query(ptr duel_ptr, const QueryCache::key &key, byte *buf, Query query)
+{
+  auto &cache = query_cache(duel_lua_state(duel_ptr));
+
+  const auto found = cache.results.find(key);
+  if (found != cache.results.cend()) {
+    std::memcpy(buf, found->second.data(), found->second.size());
+    return found->second.size();
+  }
+
+  const int32 length = query(buf);
+  cache.results.emplace(key, std::vector<byte>(buf, buf + length));
+
+  return length;
+}
+
+int32 duel_query_card(ptr duel_ptr, uint8 player, uint8 location, uint8 sequence, uint32 query_flags, byte *buf, bool use_cache)
+{
+  if (use_cache)
+    return query_card(duel_ptr, player, location, sequence, query_flags, buf, 1);
+
+  return cached_query(duel_ptr, QueryCache::key(player, location, sequence, query_flags), buf, [&](byte *out) {
+    return query_card(duel_ptr, player, location, sequence, query_flags, out, 0);
+  });
+}
+
+int32 duel_query_field_card(ptr duel_ptr, uint8 player, uint8 location, uint32 query_flags, byte *buf, bool use_cache)
+{
+  if (use_cache)
+    return query_field_card(duel_ptr, player, location, query_flags, buf, 1);
+
+  return cached_query(duel_ptr, QueryCache::key(player, location, -1, query_flags), buf, [&](byte *out) {
+    return query_field_card(duel_ptr, player, location, query_flags, out, 0);
+  });
+}
+
+// a card record of `query_field_card` is [int32 length][int32 query flags]
+// [int32 per field], QUERY_CODE first, then QUERY_POSITION (controler,
+// location, sequence and position, a byte each). empty zones are [int32 4].
+static
+int32 record_info_location(const byte *record, int32 length)
+{
+  int32 flags = 0;
+  if (length >= 12)
+    std::memcpy(&flags, record + 4, sizeof(flags));
+  if (!(flags & QUERY_POSITION))
+    return 0;
+
+  int32 info_location = 0;
+  std::memcpy(&info_location, record + ((flags & QUERY_CODE) ? 12 : 8), sizeof(info_location));
+
+  return info_location;
+}
+
+static const uint8 public_locations[] = {
+  LOCATION_MZONE, LOCATION_SZONE, LOCATION_GRAVE, LOCATION_REMOVED, LOCATION_EXTRA
+};
+
+// calls `visit(record, length)` for each card record of a location, with
+// face-down cards reduced to their position.
+template <typename Visit>
+static
+void visit_public_records(ptr duel_ptr, uint8 player, uint8 location, uint32 query_flags, Visit visit)
+{
+  byte buffer[query_buffer_size];
+
+  // positions tell which cards are face-down.
+  const int32 length = duel_query_field_card(duel_ptr, player, location, query_flags | QUERY_POSITION, buffer, false);
+
+  for (int32 offset = 0; offset + 4 <= length; ) {
+    const auto record = buffer + offset;
+    int32 record_length = 0;
+    std::memcpy(&record_length, record, sizeof(record_length));
+    if (record_length < 4 || offset + record_length > length)
+      break;
+
+    const auto info_location = record_info_location(record, record_length);
+    if ((info_location >> 24) & POS_FACEDOWN) {
+      const int32 hidden[] = { 12, QUERY_POSITION, info_location };
+      visit(reinterpret_cast<const byte *>(hidden), int32(sizeof(hidden)));
+    } else {
+      visit(record, record_length);
+    }
+    offset += record_length;
+  }
+}
+
+std::vector<byte> duel_query_snapshot(ptr duel_ptr, uint32 query_flags)
+{
+  std::vector<byte> snapshot;
+  byte buffer[query_buffer_size];
+
+  const int32 info_length = query_field_info(duel_ptr, buffer);
+  write_value(snapshot, info_length);
+  snapshot.insert(snapshot.end(), buffer, buffer + info_length);
+
+  for (uint8 player = 0; player < 2; ++player) {
+    for (const auto location : public_locations) {
+      const auto section = snapshot.size();
+      write_value<int32>(snapshot, 0);
+
+      visit_public_records(duel_ptr, player, location, query_flags, [&](const byte *record, int32 length) {
+        snapshot.insert(snapshot.end(), record, record + length);
+      });
+
+      const int32 section_length = snapshot.size() - section - sizeof(int32);
+      std::memcpy(snapshot.data() + section, &section_length, sizeof(section_length));
+    }
+  }
+
+  return snapshot;
+}
+
+// what `duel_query_changes` sent for one set of query flags, and the
+// revision at which each part last changed.
+struct FieldHistory
+{
+  struct Part
+  {
+    std::vector<byte> data;
+    uint32            changed = 0;
+  };
+
+  ///> (player, location, sequence), sequence is ignored for counts
+  using key = std::tuple<uint8, uint8, uint8>;
+
+  uint32                       revision = 0; ///> of the duel when last compared
+  uint32                       last_use = 0; ///> `FieldHistories::uses` when last queried
+  Part                         field_info;
+  std::map<key, Part>          counts;
+  std::map<key, Part>          cards;
+};
+
+// each history holds a copy of the field: only the most recently used
+// sets of flags are kept.
+struct FieldHistories
+{
+  static constexpr size_t max_histories = 4;
+
+  std::map<uint32, FieldHistory> by_query_flags;
+  uint32                         uses = 0;
+
+  FieldHistory &of(uint32 query_flags)
+  {
+    auto &history = by_query_flags[query_flags];
+    history.last_use = ++uses;
+
+    if (by_query_flags.size() > max_histories) {
+      auto oldest = by_query_flags.begin();
+      for (auto it = by_query_flags.begin(); it != by_query_flags.end(); ++it) {
+        if (it->second.last_use < oldest->second.last_use)
+          oldest = it;
+      }
+      by_query_flags.erase(oldest);
+    }
+
+    return history;
+  }
+};
+
+static const char field_histories_key = 0;
+
+// entries of the change list, after [uint8 player][uint8 location][uint8 sequence]
+enum : uint8
+{
+  CHANGE_CARD       = 0, ///> a record of `query_field_card`, [int32 4] if the slot is empty
+  CHANGE_COUNT      = 1, ///> [int32 count] of the location
+  CHANGE_FIELD_INFO = 2, ///> [int32 length] and the output of `query_field_info`
+};
+
+static
+void update_part(FieldHistory::Part &part, const byte *data, size_t length, uint32 revision)
+{
+  if (part.changed != 0 && part.data.size() == length && std::equal(data, data + length, part.data.cbegin()))
+    return;
+
+  part.data.assign(data, data + length);
+  part.changed = revision;
+}
+
+static
+void compare_field(ptr duel_ptr, FieldHistory &history, uint32 query_flags, uint32 revision)
+{
+  static const uint8 counted_locations[] = {
+    LOCATION_DECK, LOCATION_HAND, LOCATION_MZONE, LOCATION_SZONE,
+    LOCATION_GRAVE, LOCATION_REMOVED, LOCATION_EXTRA
+  };
+
+  byte buffer[query_buffer_size];
+  const int32 info_length = query_field_info(duel_ptr, buffer);
+  update_part(history.field_info, buffer, info_length, revision);
+
+  for (uint8 player = 0; player < 2; ++player) {
+    for (const auto location : counted_locations) {
+      const int32 count = query_field_count(duel_ptr, player, location);
+      update_part( history.counts[FieldHistory::key(player, location, 0)]
+                 , reinterpret_cast<const byte *>(&count), sizeof(count), revision);
+    }
+
+    for (const auto location : public_locations) {
+      uint8 sequence = 0;
+      visit_public_records(duel_ptr, player, location, query_flags, [&](const byte *record, int32 length) {
+        update_part(history.cards[FieldHistory::key(player, location, sequence++)], record, length, revision);
+      });
+
+      // the cards past the end of a pile that got shorter.
+      static const int32 empty = 4;
+      for ( auto card = history.cards.lower_bound(FieldHistory::key(player, location, sequence))
+          ; card != history.cards.end() && std::get<0>(card->first) == player && std::get<1>(card->first) == location
+          ; ++card)
+        update_part(card->second, reinterpret_cast<const byte *>(&empty), sizeof(empty), revision);
+    }
+  }
+
+  history.revision = revision;
+}
+
+std::vector<byte> duel_query_changes(ptr duel_ptr, uint32 since, uint32 query_flags)
+{
+  const auto L        = duel_lua_state(duel_ptr);
+  const auto revision = query_cache(L).revision;
+
+  auto histories = find_object<FieldHistories>(L, &field_histories_key);
+  if (!histories)
+    histories = new_object<FieldHistories>(L, &field_histories_key);
+
+  auto &history = histories->of(query_flags);
+  if (history.revision != revision)
+    compare_field(duel_ptr, history, query_flags, revision);
+
+  std::vector<byte> changes;
+  write_value(changes, revision);
+
+  const auto write_entry = [&](uint8 player, uint8 location, uint8 sequence, uint8 kind) {
+    write_value(changes, player);
+    write_value(changes, location);
+    write_value(changes, sequence);
+    write_value(changes, kind);
+  };
+
+  if (history.field_info.changed > since) {
+    write_entry(0, 0, 0, CHANGE_FIELD_INFO);
+    write_value<int32>(changes, history.field_info.data.size());
+    changes.insert(changes.end(), history.field_info.data.cbegin(), history.field_info.data.cend());
+  }
+  for (const auto &count : history.counts) {
+    if (count.second.changed <= since)
+      continue;
+    write_entry(std::get<0>(count.first), std::get<1>(count.first), 0, CHANGE_COUNT);
+    changes.insert(changes.end(), count.second.data.cbegin(), count.second.data.cend());
+  }
+  for (const auto &card : history.cards) {
+    if (card.second.changed <= since)
+      continue;
+    write_entry(std::get<0>(card.first), std::get<1>(card.first), std::get<2>(card.first), CHANGE_CARD);
+    changes.insert(changes.end(), card.second.data.cbegin(), card.second.data.cend());
+  }
+
+  return changes;
+}
+
 } // namespace ny
@@ -1,4 +1,7 @@
 #include "core/ocgapi.h"
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace ny {
 
@@ -43,4 +46,242 @@ void               global_storage_register_script( const char *script_name
 
 void               initialize_global_storage();
 
+/**
+ * switch the garbage collector of a duel's lua state between
+ * incremental (the default) and generational mode.
+ *
+ * in generational mode, minor collections only traverse objects
+ * created since the previous collection.
+ */
+void               duel_set_gc_mode(ptr duel_ptr, bool generational);
+
+/**
+ * defer a duel's garbage collection to `duel_collect_idle`.
+ *
+ * while deferred, allocations made by `process` never pay for
+ * collector work (only an allocation failure still forces a collection).
+ */
+void               duel_set_gc_deferred(ptr duel_ptr, bool deferred);
+
+/**
+ * do collector work for about `budget_ms` milliseconds, in small steps.
+ * in generational mode too: a minor or major collection left halfway is
+ * resumed by the next call (or finished by any other collection).
+ * @return true if a collection cycle (or a minor collection) completed.
+ */
+bool               duel_collect_idle(ptr duel_ptr, double budget_ms);
+
+/**
+ * bytes in use by a duel's lua state.
+ */
+double             duel_gc_count(ptr duel_ptr);
+
+struct memory_usage
+{
+  double used     = 0; ///> bytes of lua objects
+  double reserved = 0; ///> bytes the duel's heap took from the system
+  double limit    = 0; ///> see `duel_set_memory_limit`, 0 if none
+};
+
+/**
+ * memory of a duel's lua state. objects come from a heap of its own,
+ * so `reserved` also counts free slab space and is all given back when
+ * the duel ends.
+ */
+memory_usage       duel_memory_usage(ptr duel_ptr);
+
+/**
+ * cap the bytes of lua objects of a duel (0 for no cap).
+ *
+ * a script allocation that would go over it runs an emergency collection
+ * first, then fails with a memory error (see `duel_memory_exceeded`).
+ * allocations made outside scripts (by the core) are never refused: lua
+ * would abort the process.
+ */
+void               duel_set_memory_limit(ptr duel_ptr, double limit);
+
+/**
+ * @return true if an allocation failed on the duel's memory cap since
+ * the previous call.
+ */
+bool               duel_memory_exceeded(ptr duel_ptr);
+
+/**
+ * when enabled, ending the duel releases its lua heap as a whole
+ * (after running pending `__gc` metamethods) instead of freeing every
+ * lua object one by one.
+ * @return false if the duel's lua state has no heap of its own
+ */
+bool               duel_set_region_teardown(ptr duel_ptr, bool enabled);
+
+/**
+ * when enabled, large blocks the duel's collector frees (and its whole
+ * heap, when the duel ends) are given back to the system by a
+ * background thread, in batches. at most 64MB wait for that thread;
+ * past that, the duel's thread frees them itself.
+ * @return false if the duel's lua state has no heap of its own
+ */
+bool               duel_set_deferred_free(ptr duel_ptr, bool enabled);
+
+/**
+ * freeze the values defined by constant.lua in a duel's lua state.
+ *
+ * scripts compiled afterwards (card scripts) get those values inlined
+ * instead of looking them up in the global table. a script assigning
+ * to one of the names thaws it (it is looked up again from then on).
+ * @return number of frozen names (0 if constant.lua is not registered)
+ */
+int                duel_freeze_constants(ptr duel_ptr);
+
+/**
+ * load the scripts of a duel without their debug information (line
+ * numbers, local and upvalue names).
+ *
+ * a function gets it back, compiled again from the registered script,
+ * the first time an error message, a traceback or a debug hook needs
+ * it. scripts loaded before the call keep theirs.
+ */
+void               duel_strip_debug_info(ptr duel_ptr);
+
+struct precompile_result
+{
+  int                                              compiled = 0;
+  std::vector<std::pair<std::string, std::string>> errors; ///> (script name, message)
+};
+
+/**
+ * compile every registered script on `threads` threads (0 for one per
+ * core), each with a lua state of its own.
+ *
+ * duels then load the bytecode instead of compiling the source again.
+ * scripts are compiled under the chunk name the core loads them with.
+ * with `frozen_constants`, scripts are compiled with the values of
+ * constant.lua inlined, as in a duel after `duel_freeze_constants`,
+ * except the names any script assigns to: those are thawed for all of
+ * them, whatever the number of threads (the scripts are parsed twice).
+ * registering a script again drops its bytecode.
+ */
+precompile_result  precompile_all_scripts(unsigned threads, bool frozen_constants);
+
+/**
+ * limit what a duel's scripts may do in one `process` step: at most
+ * `max_instructions` lua instructions and `max_ms` milliseconds of wall
+ * time (0 for no limit; both 0 to remove the budget). checked every 1000
+ * instructions.
+ *
+ * a step over its budget aborts the duel: the running script fails, so
+ * does every script after it (even under `pcall`), and the duel does not
+ * run any more steps. only threads created after the call are limited.
+ */
+void               duel_set_step_budget(ptr duel_ptr, double max_instructions, double max_ms);
+
+struct abort_info
+{
+  bool        aborted = false;
+  std::string reason;       ///> "instruction" or "time"
+  uint32      code    = 0;  ///> card that was running, 0 if not a card script
+  std::string chunk;        ///> script that was running
+  int         line    = -1;
+};
+
+/**
+ * why a duel was aborted (`aborted` is false if it was not).
+ */
+abort_info         duel_abort_info(ptr duel_ptr);
+
+/**
+ * start a `process` step of a duel (its budget, its profiler's clock).
+ * @return false if the duel was aborted: it must not run.
+ */
+bool               duel_begin_step(ptr duel_ptr);
+
+/**
+ * end a `process` step of a duel.
+ * @return true if the duel was aborted during the step.
+ */
+bool               duel_end_step(ptr duel_ptr);
+
+/**
+ * sample where a duel's scripts spend their time: every `period` lua
+ * instructions, the running line is charged one sample and the time since
+ * the previous sample of the same step. with `count_calls`, calls to lua
+ * functions are counted too (at a cost on every call). `period` is
+ * clamped to 1..2^24.
+ *
+ * starting again drops the samples taken so far.
+ */
+void               duel_start_profiler(ptr duel_ptr, int period, bool count_calls);
+
+/**
+ * stop profiling a duel.
+ * @return the report (empty if the duel was not profiled), one entry per
+ * (card or chunk, function, line); see `parseProfile` in index.ts.
+ */
+std::vector<byte>  duel_stop_profiler(ptr duel_ptr);
+
+/**
+ * size of the buffers given to `query_card`, `query_field_card` and
+ * `query_field_info`: the core writes without checking their size.
+ */
+constexpr size_t   query_buffer_size = 0x4000;
+
+/**
+ * `query_card` and `query_field_card`, through a cache of the duel.
+ *
+ * without `use_cache`, a query only depends on the duel's state: it is run
+ * once, and asked again before the state changes, its result is copied
+ * from the cache. with `use_cache`, the core drops the fields that did not
+ * change since the card's previous query, so it always runs.
+ *
+ * the whole cache is dropped after every `process` step, so it only helps
+ * queries repeated within one step (several clients asking for the same
+ * zone). refreshing the field after each message of a step always misses.
+ */
+int32              duel_query_card( ptr duel_ptr, uint8 player, uint8 location, uint8 sequence
+                                  , uint32 query_flags, byte *buf, bool use_cache);
+
+int32              duel_query_field_card( ptr duel_ptr, uint8 player, uint8 location
+                                        , uint32 query_flags, byte *buf, bool use_cache);
+
+/**
+ * drop the cached queries of a duel and move it to its next revision.
+ * to be called after anything that changes its state: `process`,
+ * `new_card`, `start_duel`...
+ */
+void               duel_state_changed(ptr duel_ptr);
+
+/**
+ * revision of a duel's state, starting from 1.
+ */
+uint32             duel_revision(ptr duel_ptr);
+
+/**
+ * the public state of a duel in one buffer, for players reconnecting and
+ * spectators joining: the output of `query_field_info` (lp, zones, card
+ * counts, chain), then the cards of each player's monster, spell/trap,
+ * grave, banished and extra locations as `query_field_card` writes them
+ * (`query_flags`, plus QUERY_POSITION). each part starts with its int32
+ * length. face-down cards are reduced to their position.
+ */
+std::vector<byte>  duel_query_snapshot(ptr duel_ptr, uint32 query_flags);
+
+/**
+ * what changed in the public state of a duel since revision `since`
+ * (0 for everything), as seen by the snapshot query with `query_flags`.
+ *
+ * @return [uint32 current revision], then one entry per changed part:
+ * [uint8 player][uint8 location][uint8 sequence][uint8 kind] and
+ *  - kind 0, a card: its record (as in the snapshot, [int32 4] if the
+ *    slot was emptied).
+ *  - kind 1, the count of a location (hand and deck too): [int32 count].
+ *  - kind 2, the field info (player, location and sequence are 0):
+ *    [int32 length] and the output of `query_field_info`.
+ *
+ * changes are found by comparing with the previous call for the same
+ * `query_flags`, so a revision older than that call may get more
+ * entries than what really changed, never fewer. only the 4 most recently
+ * used `query_flags` are remembered; others start over with everything.
+ */
+std::vector<byte>  duel_query_changes(ptr duel_ptr, uint32 since, uint32 query_flags);
+
 } // namespace ny